@@ -0,0 +1,127 @@
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/async_sink.hpp"
+#include "lib/fixquat.hpp"
+#include "lib/multi_sink.hpp"
+#include "lib/quant.hpp"
+#include "lib/writer.hpp"
+
+// Writes N synthetic EspLog streams at once through MultiSink (io_uring and pwrite) and through
+// one AsyncSink thread per file.
+// usage: bench_sinks [n_streams] [n_blocks] [dir]
+
+static constexpr uint16_t kSamplesPerBlock = 512;
+static constexpr uint8_t kAccelBlockSize = 32;
+
+// One gyro block and the matching accel blocks per entry, encoded once up front so that the
+// numbers reflect the sinks and not the encoder.
+static std::vector<std::vector<uint8_t>> make_blocks(size_t n_blocks) {
+    std::vector<std::vector<uint8_t>> blocks;
+    std::vector<uint8_t> out(writer::max_gyro_data_size(kSamplesPerBlock));
+    std::vector<int8_t> scratch(writer::gyro_scratch_size(kSamplesPerBlock));
+
+    size_t n = writer::write_header(out.data(), out.size());
+    n += writer::write_gyro_setup(kSamplesPerBlock, out.data() + n, out.size() - n);
+    n += writer::write_accel_setup(kAccelBlockSize, 2, out.data() + n, out.size() - n);
+    blocks.emplace_back(out.begin(), out.begin() + n);
+
+    quant::State state{};
+    quat::quat q{};
+    std::vector<quat::quat> quats(kSamplesPerBlock);
+    std::vector<int16_t> acc(3 * kAccelBlockSize);
+    for (size_t b = 0; b < n_blocks; ++b) {
+        for (size_t i = 0; i < kSamplesPerBlock; ++i) {
+            double t = (b * kSamplesPerBlock + i) * 1e-3;
+            q = q * quat::quat(quat::vec(quat::base_type{0.01 * std::sin(t)},
+                                         quat::base_type{0.005 * std::cos(3 * t)},
+                                         quat::base_type{0.002}));
+            quats[i] = q;
+        }
+        std::vector<uint8_t> block;
+        n = writer::write_gyro_data(state, quats.data(), quats.size(), out.data(), out.size(),
+                                    scratch.data(), scratch.size());
+        block.insert(block.end(), out.begin(), out.begin() + n);
+        for (size_t a = 0; a < kSamplesPerBlock / kAccelBlockSize / 4; ++a) {
+            for (size_t i = 0; i < acc.size(); ++i) {
+                acc[i] = (int16_t)(std::rand() % 2048 - 1024);
+            }
+            n = writer::write_accel_data(acc.data(), kAccelBlockSize, out.data(), out.size());
+            block.insert(block.end(), out.begin(), out.begin() + n);
+        }
+        blocks.push_back(std::move(block));
+    }
+    return blocks;
+}
+
+static void report(char const* name, size_t bytes, std::chrono::steady_clock::time_point start,
+                   bool ok) {
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << ", " << s * 1e3 << " ms, "
+              << bytes / s / (1 << 20) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t n_streams = argc > 1 ? std::atoi(argv[1]) : 32;
+    size_t n_blocks = argc > 2 ? std::atoi(argv[2]) : 1000;
+    std::string dir = argc > 3 ? argv[3] : ".";
+
+    auto blocks = make_blocks(n_blocks);
+    size_t stream_bytes = 0;
+    for (auto const& block : blocks) {
+        stream_bytes += block.size();
+    }
+    size_t total = stream_bytes * n_streams;
+    std::cout << n_streams << " streams, " << stream_bytes << " bytes each" << std::endl;
+
+    auto path = [&](size_t i) { return dir + "/bench_" + std::to_string(i) + ".bin"; };
+
+    for (bool use_uring : {true, false}) {
+        auto start = std::chrono::steady_clock::now();
+        sink::MultiSink multi({.use_uring = use_uring});
+        std::vector<int> ids;
+        for (size_t i = 0; i < n_streams; ++i) {
+            ids.push_back(multi.open(path(i).c_str()));
+        }
+        bool ok = true;
+        for (auto const& block : blocks) {
+            for (int id : ids) {
+                ok &= id >= 0 && multi.write(id, block.data(), block.size());
+            }
+            ok &= multi.submit();
+        }
+        ok &= multi.close();
+        report(multi.uses_uring() ? "MultiSink io_uring" : "MultiSink pwrite", total, start, ok);
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<sink::AsyncSink>> sinks;
+        for (size_t i = 0; i < n_streams; ++i) {
+            sinks.push_back(std::make_unique<sink::AsyncSink>(path(i).c_str(), sink::Options{}));
+        }
+        for (auto const& block : blocks) {
+            for (auto& s : sinks) {
+                s->write(block.data(), block.size());
+            }
+        }
+        bool ok = true;
+        for (auto& s : sinks) {
+            ok &= s->valid() && s->close();
+        }
+        report("AsyncSink per file", total, start, ok);
+    }
+
+    for (size_t i = 0; i < n_streams; ++i) {
+        std::remove(path(i).c_str());
+    }
+    return 0;
+}
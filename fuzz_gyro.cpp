@@ -0,0 +1,131 @@
+// Feeds corrupted gyro tracks to every decoder. Each one must fail or decode, but never crash
+// or overflow, whatever quantization params the block headers or states the keyframes name.
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "lib/decoder.hpp"
+#include "lib/encoder.hpp"
+#include "lib/parallel.hpp"
+#include "lib/reader.hpp"
+#include "lib/writer.hpp"
+
+static std::vector<quat::quat> make_motion(size_t n) {
+    std::vector<quat::quat> quats(n);
+    quat::quat q{};
+    for (size_t i = 0; i < n; ++i) {
+        double t = i * 1e-3;
+        q = (q * quat::quat(quat::vec(quat::base_type{0.02 * std::sin(t)},
+                                      quat::base_type{0.01 * std::cos(7 * t)},
+                                      quat::base_type{0.3 * std::sin(40 * t)})))
+                .normalized();
+        quats[i] = q;
+    }
+    return quats;
+}
+
+static std::vector<uint8_t> encode(std::vector<quat::quat> const& quats,
+                                   quant::Params const& params, uint8_t revision) {
+    std::vector<uint8_t> file;
+    encoder::Encoder encoder({.samples_per_block = 256, .revision = revision, .params = params},
+                             [&](uint8_t const* data, size_t size) {
+                                 file.insert(file.end(), data, data + size);
+                             });
+    if (!encoder.push(quats.data(), quats.size()) || !encoder.close()) {
+        return {};
+    }
+    return file;
+}
+
+// keyframe every other block
+static std::vector<uint8_t> encode_keyframed(std::vector<quat::quat> const& quats) {
+    std::vector<uint8_t> file(64);
+    size_t n = writer::write_header(file.data(), file.size());
+    n += writer::write_gyro_setup(256, file.data() + n, file.size() - n);
+    file.resize(n);
+    auto res = parallel::encode_gyro(quats.data(), quats.size(), 256, 2, 2);
+    if (!res.success) {
+        return {};
+    }
+    file.insert(file.end(), res.data.begin(), res.data.end());
+    return file;
+}
+
+static void corrupt(std::vector<uint8_t>& file, size_t start, std::mt19937& rng) {
+    std::uniform_int_distribution<size_t> pos(start, file.size() - 1);
+    switch (rng() % 4) {
+        case 0:
+            for (int i = 0; i < 4; ++i) {
+                file[pos(rng)] ^= 1 << (rng() % 8);
+            }
+            break;
+        case 1:
+            for (size_t p = pos(rng), i = 0; i < 12 && p + i < file.size(); ++i) {
+                file[p + i] = 0;
+            }
+            break;
+        case 2:
+            for (int i = 0; i < 8; ++i) {
+                file[pos(rng)] = rng();
+            }
+            break;
+        default:
+            file.resize(pos(rng));
+    }
+}
+
+static void decode_all(std::vector<uint8_t> const& file) {
+    decoder::decode_gyro(file.data(), file.size());
+    decoder::decode_rates(file.data(), file.size());
+    std::vector<quat::quat> quats;
+    reader::read_gyro(file.data(), file.size(), quats);
+
+    decoder::StreamDecoder stream;
+    quats.resize(4096);
+    for (size_t i = 0; i < file.size() && !stream.error(); i += 97) {
+        stream.push(file.data() + i, std::min<size_t>(97, file.size() - i));
+        while (stream.pull(quats.data(), quats.size()) == quats.size()) {
+        }
+    }
+}
+
+int main() {
+    using quant::Predictor;
+    using quant::Rounding;
+    static constexpr quant::Params kParams[] = {
+        {.qp = {14, 14, 14}},
+        {.qp = {14, 14, 14}, .predictor = Predictor::kLinear},
+        {.qp = {12, 14, 16}, .rounding = Rounding::kNearest, .predictor = Predictor::kHalf},
+        {.qp = {14, 14, 14}, .rounding = Rounding::kDeadZone, .dead_zone = 5,
+         .predictor = Predictor::kLinear},
+    };
+
+    std::vector<quat::quat> quats = make_motion(8 * 256);
+    std::vector<std::vector<uint8_t>> files;
+    for (quant::Params const& params : kParams) {
+        for (uint8_t revision : {1, 2}) {
+            files.push_back(encode(quats, params, revision));
+        }
+    }
+    files.push_back(encode_keyframed(quats));
+
+    std::mt19937 rng(1);
+    size_t n_decoded = 0;
+    for (auto const& file : files) {
+        auto track = decoder::decode_gyro(file.data(), file.size());
+        if (!track.success || track.quats.size() != quats.size()) {
+            std::printf("clean file does not decode\n");
+            return 1;
+        }
+        // keep the header and gyro setup intact
+        for (int i = 0; i < 200; ++i) {
+            std::vector<uint8_t> mutated = file;
+            corrupt(mutated, 12, rng);
+            decode_all(mutated);
+            n_decoded += 1;
+        }
+    }
+    std::printf("%zu corrupted files decoded\n", n_decoded);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "async_sink.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace sink {
+AsyncSink::AsyncSink(char const* path, Options const& options) : options_(options) {
+    fd_ = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        return;
+    }
+    front_.reserve(options_.buffer_size);
+    back_.reserve(options_.buffer_size);
+    thread_ = std::thread([this] { run(); });
+}
+
+AsyncSink::~AsyncSink() { close(); }
+
+void AsyncSink::write(uint8_t const* data, size_t size) {
+    if (fd_ < 0) {
+        return;
+    }
+    front_.insert(front_.end(), data, data + size);
+    if (front_.size() >= options_.buffer_size) {
+        bool submitted = submit();
+        if (!submitted && !overrun_) {
+            overruns_ += 1;
+        }
+        overrun_ = !submitted;
+    }
+}
+
+void AsyncSink::flush() {
+    if (fd_ >= 0 && !front_.empty()) {
+        submit();
+    }
+}
+
+bool AsyncSink::submit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_) {
+        return false;
+    }
+    std::swap(front_, back_);
+    front_.clear();
+    pending_ = true;
+    cv_.notify_all();
+    return true;
+}
+
+bool AsyncSink::close() {
+    if (fd_ < 0) {
+        return !error_;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return !pending_; });
+        std::swap(front_, back_);
+        front_.clear();
+        pending_ = !back_.empty();
+        closing_ = true;
+        cv_.notify_all();
+    }
+    thread_.join();
+    if (options_.sync != Sync::kNone && fdatasync(fd_) != 0) {
+        error_ = true;
+    }
+    if (::close(fd_) != 0) {
+        error_ = true;
+    }
+    fd_ = -1;
+    return !error_;
+}
+
+bool AsyncSink::write_all(uint8_t const* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd_, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void AsyncSink::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [&] { return pending_ || closing_; });
+        if (!pending_) {
+            return;
+        }
+        // back_ belongs to this thread until pending_ is cleared
+        lock.unlock();
+        if (!error_) {
+            if (!write_all(back_.data(), back_.size())) {
+                error_ = true;
+            }
+            unsynced_ += back_.size();
+            bool sync = options_.sync == Sync::kEvery ||
+                        (options_.sync == Sync::kInterval && unsynced_ >= options_.sync_bytes);
+            if (sync) {
+                if (fdatasync(fd_) != 0) {
+                    error_ = true;
+                }
+                unsynced_ = 0;
+            }
+        }
+        lock.lock();
+        back_.clear();
+        pending_ = false;
+        cv_.notify_all();
+    }
+}
+}  // namespace sink
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sink {
+enum class Sync : uint8_t {
+    kNone,      // leave it to the page cache, never sync
+    kEvery,     // fdatasync after every buffer written
+    kInterval,  // fdatasync once at least sync_bytes have been written since the last one
+};
+
+struct Options {
+    size_t buffer_size{1 << 16};
+    Sync sync{Sync::kNone};
+    size_t sync_bytes{1 << 20};
+};
+
+// Double-buffered file output. write() only appends to the front buffer; once that is full it
+// is swapped with the back buffer, which a dedicated I/O thread writes (and syncs) in the
+// background. The calling thread never waits for the disk: if the I/O thread is still busy
+// with the previous buffer, the front buffer grows instead. overruns() counts how often that
+// happened.
+class AsyncSink {
+   public:
+    AsyncSink(char const* path, Options const& options);
+    ~AsyncSink();
+    AsyncSink(AsyncSink const&) = delete;
+    AsyncSink& operator=(AsyncSink const&) = delete;
+
+    bool valid() const { return fd_ >= 0; }
+
+    // Matches encoder::Encoder::Sink.
+    void write(uint8_t const* data, size_t size);
+
+    // Hands the front buffer to the I/O thread if it is idle, even if the buffer is not full.
+    void flush();
+
+    // Writes out everything, syncs unless the policy is kNone and closes the file. Waits for the
+    // I/O thread. Returns false if any write or sync failed.
+    bool close();
+
+    bool error() const { return error_; }
+    size_t overruns() const { return overruns_; }
+
+   private:
+    // Swaps the buffers if the I/O thread is idle, returns false otherwise.
+    bool submit();
+    void run();
+    bool write_all(uint8_t const* data, size_t size);
+
+    int fd_{-1};
+    Options options_;
+    std::vector<uint8_t> front_;
+    std::vector<uint8_t> back_;
+    bool overrun_{};
+    bool pending_{};
+    bool closing_{};
+    std::atomic<bool> error_{};
+    std::atomic<size_t> overruns_{};
+    size_t unsynced_{};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
+}  // namespace sink
@@ -0,0 +1,153 @@
+#include "bitpack.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace bitpack {
+static constexpr size_t kMaxGroups = (kMaxSamples - 1 + kGroup - 1) / kGroup;
+
+static inline size_t n_groups(size_t n_samples) { return (n_samples - 1 + kGroup - 1) / kGroup; }
+
+size_t max_packed_size(size_t n_samples) {
+    return n_samples ? 3 * (2 + n_groups(n_samples) * (1 + 2 * kGroup)) : 0;
+}
+
+// Zigzag mapped deltas of x[1..n), padded with zeros to whole groups.
+static void encode_deltas(int16_t const* x, size_t n, uint16_t* z) {
+    size_t n_deltas = n - 1;
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 8 <= n_deltas; j += 8) {
+        __m128i cur = _mm_loadu_si128((__m128i const*)(x + j + 1));
+        __m128i prev = _mm_loadu_si128((__m128i const*)(x + j));
+        __m128i d = _mm_sub_epi16(cur, prev);
+        __m128i zz = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+        _mm_storeu_si128((__m128i*)(z + j), zz);
+    }
+#endif
+    for (; j < n_deltas; ++j) {
+        int16_t d = (int16_t)(uint16_t)(x[j + 1] - x[j]);
+        z[j] = (uint16_t)((uint16_t)d << 1) ^ (uint16_t)(d >> 15);
+    }
+    for (; j < n_groups(n) * kGroup; ++j) {
+        z[j] = 0;
+    }
+}
+
+static inline int group_width(uint16_t const* z) {
+#ifdef __SSE2__
+    __m128i v = _mm_loadu_si128((__m128i const*)z);
+    v = _mm_or_si128(v, _mm_srli_si128(v, 8));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 4));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 2));
+    unsigned bits = _mm_cvtsi128_si32(v) & 0xffff;
+#else
+    unsigned bits = 0;
+    for (size_t k = 0; k < kGroup; ++k) {
+        bits |= z[k];
+    }
+#endif
+    return bits ? 32 - __builtin_clz(bits) : 0;
+}
+
+// Inverse of encode_deltas for one group: x[0..kGroup) = prev + running sum of the deltas.
+static inline int16_t decode_group(uint16_t const* z, int16_t prev, int16_t* x) {
+#ifdef __SSE2__
+    __m128i zz = _mm_loadu_si128((__m128i const*)z);
+    __m128i sign = _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(zz, _mm_set1_epi16(1)));
+    __m128i d = _mm_xor_si128(_mm_srli_epi16(zz, 1), sign);
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+    d = _mm_add_epi16(d, _mm_set1_epi16(prev));
+    _mm_storeu_si128((__m128i*)x, d);
+    return (int16_t)_mm_extract_epi16(d, 7);
+#else
+    for (size_t k = 0; k < kGroup; ++k) {
+        uint16_t d = (z[k] >> 1) ^ (uint16_t)-(z[k] & 1);
+        prev = (int16_t)(uint16_t)(prev + d);
+        x[k] = prev;
+    }
+    return prev;
+#endif
+}
+
+size_t pack_accel(int16_t const* acc, size_t n_samples, uint8_t* data, size_t n_data) {
+    if (n_samples == 0 || n_samples > kMaxSamples) {
+        return 0;
+    }
+    int16_t x[kMaxSamples];
+    uint16_t z[kMaxGroups * kGroup];
+    size_t n = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (size_t i = 0; i < n_samples; ++i) {
+            x[i] = acc[3 * i + axis];
+        }
+        encode_deltas(x, n_samples, z);
+
+        if (n + 2 > n_data) {
+            return 0;
+        }
+        data[n++] = ((uint16_t)x[0] >> 0) & 0xff;
+        data[n++] = ((uint16_t)x[0] >> 8) & 0xff;
+        for (size_t g = 0; g < n_groups(n_samples); ++g) {
+            uint16_t const* group = z + g * kGroup;
+            int width = group_width(group);
+            if (n + 1 + width > n_data) {
+                return 0;
+            }
+            data[n++] = width;
+            uint32_t bits = 0;
+            int n_bits = 0;
+            for (size_t k = 0; k < kGroup; ++k) {
+                bits |= (uint32_t)group[k] << n_bits;
+                n_bits += width;
+                for (; n_bits >= 8; n_bits -= 8, bits >>= 8) {
+                    data[n++] = bits & 0xff;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+bool unpack_accel(uint8_t const* data, size_t n_data, int16_t* acc, size_t n_samples) {
+    if (n_samples == 0 || n_samples > kMaxSamples) {
+        return false;
+    }
+    // room for the padding of the last group
+    int16_t x[1 + kMaxGroups * kGroup];
+    uint16_t z[kGroup];
+    size_t n = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (n + 2 > n_data) {
+            return false;
+        }
+        x[0] = (int16_t)(data[n] | (data[n + 1] << 8));
+        n += 2;
+        for (size_t g = 0; g < n_groups(n_samples); ++g) {
+            if (n + 1 > n_data || data[n] > 16 || n + 1 + data[n] > n_data) {
+                return false;
+            }
+            int width = data[n++];
+            uint32_t mask = (1U << width) - 1;
+            uint32_t bits = 0;
+            int n_bits = 0;
+            for (size_t k = 0; k < kGroup; ++k) {
+                for (; n_bits < width; n_bits += 8) {
+                    bits |= (uint32_t)data[n++] << n_bits;
+                }
+                z[k] = bits & mask;
+                bits >>= width;
+                n_bits -= width;
+            }
+            decode_group(z, x[g * kGroup], x + 1 + g * kGroup);
+        }
+        for (size_t i = 0; i < n_samples; ++i) {
+            acc[3 * i + axis] = x[i];
+        }
+    }
+    return n == n_data;
+}
+}  // namespace bitpack
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace bitpack {
+// Lossless accel payload without entropy coding. Per axis: the first sample as int16, then the
+// deltas between consecutive samples, zigzag mapped, in groups of kGroup. Each group is a width
+// byte w followed by kGroup values of w bits, LSB first, so exactly w bytes. The last group is
+// padded with zero deltas. Delta, zigzag and the prefix sum on decode use SSE2 if available.
+static constexpr size_t kGroup = 8;
+static constexpr size_t kMaxSamples = 255;
+
+// Worst case payload size for n_samples triplets.
+size_t max_packed_size(size_t n_samples);
+
+// Returns the payload size, 0 if n_samples is out of range or the payload does not fit.
+size_t pack_accel(int16_t const* acc, size_t n_samples, uint8_t* data, size_t n_data);
+
+// The payload must be consumed exactly.
+bool unpack_accel(uint8_t const* data, size_t n_data, int16_t* acc, size_t n_samples);
+}  // namespace bitpack
@@ -4,107 +4,560 @@
 #include "laplace_model.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 
 namespace compress {
 static constexpr uint32_t RANS_BYTE_L = 1U << 23;
 
-static inline size_t rans_encode(int8_t* data, size_t n_data, uint8_t* out, size_t n_out,
-                                 uint8_t i_var) {
-    uint32_t state = RANS_BYTE_L;
-    size_t bytes_put = 0;
-    for (size_t i = n_data; i--;) {
-        int8_t sym = data[i];
+// Block header: [qp_x | flags] [qp_y, qp_z, only if kFlagAxisQp] [mode, only if kFlagMode]
+// [i_var | cksum << 5, absent if kFlagStatic]
+// Static blocks have all-zero updates and carry no entropy coded payload.
+// mode: bits 0-1 rounding, bits 2-4 dead zone, bits 5-6 predictor, bit 7 joint triplets
+static constexpr uint8_t kQpMask = 0x1f;
+static constexpr uint8_t kFlagAxisQp = 0x20;
+static constexpr uint8_t kFlagStatic = 0x40;
+static constexpr uint8_t kFlagMode = 0x80;
+static constexpr uint8_t kModeJoint = 0x80;
+
+struct Header {
+    quant::Params params{};
+    bool is_static{};
+    bool joint{};
+};
+
+static inline bool has_axis_qp(quant::Params const& params) {
+    return params.qp[1] != params.qp[0] || params.qp[2] != params.qp[0];
+}
+
+static inline bool has_mode_byte(Header const& header) {
+    return header.params.rounding != quant::Rounding::kFloor ||
+           header.params.predictor != quant::Predictor::kConstant || header.joint;
+}
+
+// the largest header, with the i_var byte
+static constexpr size_t kMaxHeaderSize = 5;
+
+// size of the header up to (not including) the i_var byte
+static inline size_t params_size(Header const& header) {
+    return 1 + (has_axis_qp(header.params) ? 2 : 0) + (has_mode_byte(header) ? 1 : 0);
+}
+
+static inline size_t put_header(Header const& header, uint8_t* data) {
+    quant::Params const& params = header.params;
+    size_t n = 1;
+    data[0] = (params.qp[0] & kQpMask) | (header.is_static ? kFlagStatic : 0);
+    if (has_axis_qp(params)) {
+        data[0] |= kFlagAxisQp;
+        data[n++] = params.qp[1] & kQpMask;
+        data[n++] = params.qp[2] & kQpMask;
+    }
+    if (has_mode_byte(header)) {
+        data[0] |= kFlagMode;
+        data[n++] = (uint8_t)params.rounding | ((params.dead_zone & 0x7) << 2) |
+                    ((uint8_t)params.predictor << 5) | (header.joint ? kModeJoint : 0);
+    }
+    return n;
+}
+
+static inline size_t get_header(uint8_t const* data, size_t n_data, Header& header) {
+    if (n_data < 1) {
+        return 0;
+    }
+    size_t n = 1;
+    uint8_t qp = data[0] & kQpMask;
+    if (qp > quant::kMaxQp) {
+        return 0;
+    }
+    header = Header{.params = {.qp = {qp, qp, qp}}, .is_static = (data[0] & kFlagStatic) != 0};
+    quant::Params& params = header.params;
+    if (data[0] & kFlagAxisQp) {
+        if (n_data < n + 2 || data[n] > quant::kMaxQp || data[n + 1] > quant::kMaxQp) {
+            return 0;
+        }
+        params.qp[1] = data[n++];
+        params.qp[2] = data[n++];
+    }
+    if (data[0] & kFlagMode) {
+        if (n_data < n + 1 || (data[n] & 0x3) > (uint8_t)quant::Rounding::kDeadZone ||
+            ((data[n] >> 5) & 0x3) > (uint8_t)quant::Predictor::kHalf) {
+            return 0;
+        }
+        params.rounding = (quant::Rounding)(data[n] & 0x3);
+        params.dead_zone = (data[n] >> 2) & 0x7;
+        params.predictor = (quant::Predictor)((data[n] >> 5) & 0x3);
+        header.joint = (data[n] & kModeJoint) != 0;
+        n += 1;
+    }
+    return n;
+}
+
+// Joint triplet alphabet: every (x, y, z) with components in [-2, 2] gets a rank, ordered by
+// L1 norm. Ranks are zigzag mapped onto the int8 symbols so that the Laplace tables still fit.
+// Rank kJointEscape sits right after the triplets with L1 <= 2 and is followed by the three
+// components coded one by one.
+static constexpr int kJointRange = 2;
+static constexpr int kJointSide = 2 * kJointRange + 1;
+static constexpr int kJointTriplets = kJointSide * kJointSide * kJointSide;
+static constexpr int kJointRanks = kJointTriplets + 1;
+static constexpr int kJointEscapeRank = 25;
+
+struct JointTables {
+    uint8_t rank_of[kJointTriplets]{};
+    int8_t triplet_of[kJointRanks][3]{};
+};
+
+static constexpr int joint_index(int x, int y, int z) {
+    return ((x + kJointRange) * kJointSide + (y + kJointRange)) * kJointSide + (z + kJointRange);
+}
+
+static constexpr JointTables make_joint_tables() {
+    JointTables t{};
+    int rank = 0;
+    for (int l1 = 0; l1 <= 3 * kJointRange; ++l1) {
+        if (rank == kJointEscapeRank) {
+            rank += 1;
+        }
+        for (int x = -kJointRange; x <= kJointRange; ++x) {
+            for (int y = -kJointRange; y <= kJointRange; ++y) {
+                for (int z = -kJointRange; z <= kJointRange; ++z) {
+                    if ((x < 0 ? -x : x) + (y < 0 ? -y : y) + (z < 0 ? -z : z) != l1) continue;
+                    t.rank_of[joint_index(x, y, z)] = rank;
+                    t.triplet_of[rank][0] = x;
+                    t.triplet_of[rank][1] = y;
+                    t.triplet_of[rank][2] = z;
+                    rank += 1;
+                }
+            }
+        }
+    }
+    return t;
+}
+
+static constexpr JointTables kJoint = make_joint_tables();
+
+static constexpr int8_t rank_to_symbol(int rank) {
+    return (rank & 1) ? -((rank + 1) >> 1) : rank >> 1;
+}
+
+static constexpr int symbol_to_rank(int8_t sym) { return sym >= 0 ? 2 * sym : -2 * sym - 1; }
+
+static constexpr int8_t kJointEscape = rank_to_symbol(kJointEscapeRank);
+
+static inline bool in_joint_range(int8_t const* t) {
+    return t[0] >= -kJointRange && t[0] <= kJointRange && t[1] >= -kJointRange &&
+           t[1] <= kJointRange && t[2] >= -kJointRange && t[2] <= kJointRange;
+}
+
+// Calls fn for every coded symbol of the block, last one first. Stops if fn returns false.
+template <class Fn>
+static inline bool visit_symbols_reversed(int8_t const* data, size_t n_data, bool joint, Fn&& fn) {
+    if (!joint) {
+        for (size_t i = n_data; i--;) {
+            if (!fn(data[i])) return false;
+        }
+        return true;
+    }
+    for (size_t i = n_data; i >= 3; i -= 3) {
+        int8_t const* t = data + i - 3;
+        if (in_joint_range(t)) {
+            if (!fn(rank_to_symbol(kJoint.rank_of[joint_index(t[0], t[1], t[2])]))) return false;
+        } else {
+            if (!fn(t[2]) || !fn(t[1]) || !fn(t[0]) || !fn(kJointEscape)) return false;
+        }
+    }
+    return true;
+}
+
+struct Coding {
+    uint8_t i_var{};
+    double bits{};
+    size_t n_coded{};
+};
+
+// Picks the table for a symbol stream and estimates its coded size.
+static inline Coding estimate_coding(int8_t const* data, size_t n_data, bool joint) {
+    uint32_t hist[256]{};
+    int64_t sum = 0;
+    size_t count = 0;
+    visit_symbols_reversed(data, n_data, joint, [&](int8_t sym) {
+        hist[(uint8_t)sym] += 1;
+        sum += (int64_t)sym * (int64_t)sym;
+        count += 1;
+        return true;
+    });
+
+    Coding coding{.i_var = model::var_to_ivar(double(sum) / count), .n_coded = count};
+    for (int sym = -128; sym < 128; ++sym) {
+        if (uint32_t n = hist[(uint8_t)sym]) {
+            coding.bits += n * (model::scale() - std::log2(model::freq(sym, coding.i_var)));
+        }
+    }
+    return coding;
+}
+
+// Renormalization takes the state from below 2^31 to below 2^16 * freq, so every symbol emits
+// at most kMaxRansBytes bytes, and the final state takes 4 more.
+static constexpr size_t kMaxRansBytes = 2;
+
+static inline size_t max_rans_size(size_t n_coded) { return kMaxRansBytes * n_coded + 4; }
+
+// Symbols are encoded last one first, so the decoder reads the bytes in the opposite order to
+// how they are produced. The encoder writes backwards from `end` towards `begin`, the finished
+// stream is [pos, end). kChecked = false if there is room for max_rans_size bytes.
+template <bool kChecked = true>
+struct RansEncoder {
+    uint8_t* begin;
+    uint8_t* end;
+    uint8_t i_var;
+    uint32_t state{RANS_BYTE_L};
+    uint8_t* pos{end};
+
+    bool put(int8_t sym) {
         int start = model::cdf(sym, i_var);
         int freq = model::cdf(sym + 1, i_var) - start;
         uint32_t x_max = ((RANS_BYTE_L >> model::scale()) << 8) * freq;
         while (state >= x_max) {
-            if (bytes_put >= n_out) {
-                return 0;
+            if (kChecked && pos == begin) {
+                return false;
             }
-            out[bytes_put] = state & 0xff;
-            bytes_put += 1;
+            *--pos = state & 0xff;
             state >>= 8;
         }
         state = ((state / freq) << model::scale()) + (state % freq) + start;
+        return true;
     }
-    out[bytes_put + 0] = (state >> 24);
-    out[bytes_put + 1] = (state >> 16);
-    out[bytes_put + 2] = (state >> 8);
-    out[bytes_put + 3] = (state >> 0);
-    bytes_put += 4;
-    std::reverse(out, out + bytes_put);
-    return bytes_put;
+
+    // Returns the size of the stream, 0 if it does not fit.
+    size_t finish() {
+        if (kChecked && pos - begin < 4) {
+            return 0;
+        }
+        pos -= 4;
+        pos[0] = (state >> 0);
+        pos[1] = (state >> 8);
+        pos[2] = (state >> 16);
+        pos[3] = (state >> 24);
+        return end - pos;
+    }
+};
+
+template <bool kChecked>
+static inline size_t rans_encode(int8_t const* data, size_t n_data, bool joint, uint8_t* begin,
+                                 uint8_t* end, uint8_t i_var) {
+    RansEncoder<kChecked> enc{.begin = begin, .end = end, .i_var = i_var};
+    if (!visit_symbols_reversed(data, n_data, joint, [&](int8_t sym) { return enc.put(sym); })) {
+        return 0;
+    }
+    return enc.finish();
+}
+
+// Encodes into the end of the room it needs at most, n_coded being the number of symbols the
+// stream codes, and moves the stream to `out` once it is complete. Without that much room the
+// encoder checks for the start of the buffer on every byte.
+static inline size_t rans_encode(int8_t const* data, size_t n_data, bool joint, size_t n_coded,
+                                 uint8_t* out, size_t n_out, uint8_t i_var) {
+    size_t n_room = max_rans_size(n_coded);
+    size_t n = n_out >= n_room
+                   ? rans_encode<false>(data, n_data, joint, out, out + n_room, i_var)
+                   : rans_encode<true>(data, n_data, joint, out, out + n_out, i_var);
+    if (n > 0) {
+        memmove(out, out + std::min(n_out, n_room) - n, n);
+    }
+    return n;
+}
+
+size_t max_payload_size(size_t n_symbols) {
+    // joint coding can take four symbols for a triplet, an escape and its components
+    return kMaxHeaderSize + max_rans_size(n_symbols + n_symbols / 3);
 }
 
 CompressResult compress_block(quant::State state, quat::quat const* quats, size_t n_quats,
-                              uint8_t qp, uint8_t* data, size_t n_data, int8_t* scratch,
-                              size_t n_scratch) {
-    auto quant_result = quant::quant_block(state, quats, n_quats, qp, scratch, n_scratch);
+                              quant::Params const& params, uint8_t* data, size_t n_data,
+                              int8_t* scratch, size_t n_scratch,
+                              quant::Reconstruction const& recon) {
+    auto quant_result =
+        quant::quant_block(state, quats, n_quats, params, scratch, n_scratch, recon);
     if (!quant_result.success) {
         return CompressResult{.success = false};
     }
 
-    int i_var{};
+    auto res = encode_symbols(params, scratch, quant_result.bytes_put, data, n_data);
+    res.new_state = quant_result.new_state;
+    return res;
+}
+
+CompressResult encode_symbols(quant::Params const& params, int8_t const* symbols,
+                              size_t n_symbols, uint8_t* data, size_t n_data) {
+    if (*std::max_element(params.qp, params.qp + 3) > quant::kMaxQp) {
+        return CompressResult{.success = false};
+    }
     uint8_t cksum{};
-    {
-        int64_t sum = 0;
-        for (size_t i = 0; i < quant_result.bytes_put; ++i) {
-            sum += (int64_t)scratch[i] * (int64_t)scratch[i];
-            cksum += (uint8_t)scratch[i];
+    int64_t sum = 0;
+    for (size_t i = 0; i < n_symbols; ++i) {
+        sum += (int64_t)symbols[i] * (int64_t)symbols[i];
+        cksum += (uint8_t)symbols[i];
+    }
+
+    Header header{.params = params, .is_static = sum == 0};
+    if (header.is_static) {
+        if (n_data < params_size(header)) {
+            return CompressResult{.success = false};
         }
-        i_var = model::var_to_ivar(double(sum) / quant_result.bytes_put);
+        return CompressResult{
+            .success = true, .bytes_put = put_header(header, data), .dbg_qbytes = n_symbols};
     }
 
-    size_t rans_result = rans_encode(scratch, quant_result.bytes_put, data + 2, n_data - 2, i_var);
+    Coding plain = estimate_coding(symbols, n_symbols, false);
+    Coding joint = estimate_coding(symbols, n_symbols, true);
+    header.joint = joint.bits < plain.bits;
+    Coding const& coding = header.joint ? joint : plain;
+
+    size_t n_header = params_size(header) + 1;
+    if (n_data < n_header) {
+        return CompressResult{.success = false};
+    }
+    size_t rans_result = rans_encode(symbols, n_symbols, header.joint, coding.n_coded,
+                                     data + n_header, n_data - n_header, coding.i_var);
     if (rans_result == 0) {
         return CompressResult{.success = false};
     }
 
-    data[0] = qp;
-    data[1] = (i_var) | (cksum << 5);
+    size_t n_params = put_header(header, data);
+    data[n_params] = (coding.i_var) | (cksum << 5);
 
-    return CompressResult{.success = true,
-                          .new_state = quant_result.new_state,
-                          .bytes_put = rans_result + 2,
-                          .dbg_qbytes = quant_result.bytes_put};
+    return CompressResult{
+        .success = true, .bytes_put = rans_result + n_header, .dbg_qbytes = n_symbols};
 }
 
-DecompressResult decompress_block(quant::State state, uint8_t const* data, size_t n_data,
-                                  quat::quat* quats, size_t n_quats) {
-    uint8_t qp = data[0];
-    uint8_t i_var = data[1] & 0x1f;
-    uint8_t cksum = data[1] >> 5;
+quant::Params choose_params(quant::State state, quat::quat const* quats, size_t n_quats,
+                            quant::Params base, quat::base_type max_err, int8_t* scratch,
+                            size_t n_scratch) {
+    auto fits = [&](quant::Params const& params) {
+        auto res = quant::quant_block(state, quats, n_quats, params, scratch, n_scratch);
+        return res.success && res.max_ang_err <= max_err;
+    };
 
-    uint32_t rstate = (((uint32_t)data[2]) << 0) | (((uint32_t)data[3]) << 8) |
-                      (((uint32_t)data[4]) << 16) | (((uint32_t)data[5]) << 24);
-    size_t bytes_eaten = 6;
+    if (!fits(base)) {
+        return base;
+    }
 
-    size_t quats_put{};
-    uint8_t own_cksum{};
+    // raise each axis one step at a time so that no axis eats the whole budget
+    bool done[3]{};
+    while (!(done[0] && done[1] && done[2])) {
+        for (int axis = 0; axis < 3; ++axis) {
+            if (done[axis]) continue;
+            quant::Params params = base;
+            params.qp[axis] += 1;
+            if (params.qp[axis] > quant::kMaxQp || !fits(params)) {
+                done[axis] = true;
+            } else {
+                base = params;
+            }
+        }
+    }
+    return base;
+}
+
+static DecompressResult decompress_static(quant::State state, quant::Params const& params,
+                                          size_t bytes_eaten, quat::quat* quats, size_t n_quats) {
+    // Even without motion every sample is integrated: the encoder normalizes q after each one
+    // and fixed-point normalization is not idempotent, so skipping it would drift.
+    static constexpr int8_t kZero[3]{};
+    for (size_t i = 0; i < n_quats; ++i) {
+        if (quant::dequant_one(state, kZero, params) == quant::Step::kInvalid) {
+            return DecompressResult{.success = false};
+        }
+        quats[i] = state.q;
+    }
+    return DecompressResult{
+        .success = true, .new_state = state, .bytes_eaten = bytes_eaten, .quats_put = n_quats};
+}
+
+// Decodes one symbol, the caller renormalizes.
+static inline int8_t rans_step(uint32_t& rstate, uint8_t i_var) {
     uint32_t mask = (1U << model::scale()) - 1;
-    while (quats_put < n_quats) {
-        int8_t s[3];
-        for (size_t i = 0; i < 3; ++i) {
-            int cum = rstate & mask;
-            int sym = model::icdf(cum, i_var);
-            s[i] = sym;
-            own_cksum += (uint8_t)s[i];
+    int8_t sym = model::icdf(rstate & mask, i_var);
 
-            int start = model::cdf(sym, i_var);
-            int freq = model::cdf(sym + 1, i_var) - start;
+    int start = model::cdf(sym, i_var);
+    int freq = model::cdf(sym + 1, i_var) - start;
 
-            rstate = freq * (rstate >> model::scale()) + (rstate & mask) - start;
+    rstate = freq * (rstate >> model::scale()) + (rstate & mask) - start;
+    return sym;
+}
 
-            while (rstate < RANS_BYTE_L) {
-                if (bytes_eaten >= n_data) {
-                    return DecompressResult{.success = false};
+static inline bool joint_triplet(int8_t sym, int8_t* s) {
+    int rank = symbol_to_rank(sym);
+    if (rank >= kJointRanks) {
+        return false;
+    }
+    std::copy(kJoint.triplet_of[rank], kJoint.triplet_of[rank] + 3, s);
+    return true;
+}
+
+// Entropy decodes the payload of a non-static block, handing every update triplet to
+// on_triplet until n_quats samples are complete. bytes_eaten starts at the header size.
+// kPadded: renormalization reads skip the bounds check. A triplet (at most 4 symbols, each
+// renormalized by at most 2 bytes) reads at most kDecodePadding bytes, so checking once per
+// triplet keeps the reads within the padding.
+template <bool kPadded = false, class OnTriplet>
+static bool decode_payload(Header const& header, uint8_t const* data, size_t n_data,
+                           size_t& bytes_eaten, size_t n_quats, OnTriplet&& on_triplet) {
+    size_t n_params = bytes_eaten;
+    if (n_data < n_params + 5) {
+        return false;
+    }
+    uint8_t i_var = data[n_params] & 0x1f;
+    uint8_t cksum = data[n_params] >> 5;
+    if (i_var > 15) {
+        return false;
+    }
+
+    uint8_t const* rdata = data + n_params + 1;
+    uint32_t rstate = (((uint32_t)rdata[0]) << 0) | (((uint32_t)rdata[1]) << 8) |
+                      (((uint32_t)rdata[2]) << 16) | (((uint32_t)rdata[3]) << 24);
+    bytes_eaten = n_params + 5;
+    // the encoder's state never drops below RANS_BYTE_L, which also bounds the renormalization
+    // bytes per symbol the padded path relies on
+    if (rstate < RANS_BYTE_L) {
+        return false;
+    }
+
+    auto next_symbol = [&](int8_t& sym) {
+        sym = rans_step(rstate, i_var);
+        while (rstate < RANS_BYTE_L) {
+            if (!kPadded && bytes_eaten >= n_data) {
+                return false;
+            }
+            rstate = (rstate << 8) | data[bytes_eaten];
+            bytes_eaten += 1;
+        }
+        return true;
+    };
+
+    size_t samples{};
+    uint8_t own_cksum{};
+    while (samples < n_quats) {
+        if (kPadded && bytes_eaten > n_data) {
+            return false;
+        }
+        int8_t s[3];
+        if (header.joint) {
+            int8_t sym;
+            if (!next_symbol(sym)) {
+                return false;
+            }
+            if (sym == kJointEscape) {
+                if (!next_symbol(s[0]) || !next_symbol(s[1]) || !next_symbol(s[2])) {
+                    return false;
                 }
-                rstate = (rstate << 8) | data[bytes_eaten];
-                bytes_eaten += 1;
+            } else if (!joint_triplet(sym, s)) {
+                return false;
             }
+        } else {
+            if (!next_symbol(s[0]) || !next_symbol(s[1]) || !next_symbol(s[2])) {
+                return false;
+            }
+        }
+        own_cksum += (uint8_t)s[0] + (uint8_t)s[1] + (uint8_t)s[2];
+
+        if (!on_triplet(s)) {
+            return false;
         }
+        if (!quant::single_update{s[0], s[1], s[2]}.is_saturated()) {
+            samples += 1;
+        }
+    }
+    // only the low 3 bits of the checksum fit into the header
+    return (!kPadded || bytes_eaten <= n_data) && (own_cksum & 0x7) == cksum;
+}
+
+DecompressResult decompress_block(quant::State state, uint8_t const* data, size_t n_data,
+                                  quat::quat* quats, size_t n_quats) {
+    Header header;
+    size_t bytes_eaten = get_header(data, n_data, header);
+    if (bytes_eaten == 0) {
+        return DecompressResult{.success = false};
+    }
+    if (header.is_static) {
+        return decompress_static(state, header.params, bytes_eaten, quats, n_quats);
+    }
+
+    size_t quats_put{};
+    bool ok = decode_payload(header, data, n_data, bytes_eaten, n_quats, [&](int8_t const* s) {
+        quant::Step step = quant::dequant_one(state, s, header.params);
+        if (step == quant::Step::kSample) {
+            quats[quats_put] = state.q;
+            quats_put += 1;
+        }
+        return step != quant::Step::kInvalid;
+    });
+    if (!ok) {
+        return DecompressResult{.success = false};
+    }
+    return DecompressResult{
+        .success = true, .new_state = state, .bytes_eaten = bytes_eaten, .quats_put = quats_put};
+}
+
+template <bool kPadded>
+static SymbolsResult decode_symbols_impl(uint8_t const* data, size_t n_data, size_t n_quats,
+                                         int8_t* symbols, size_t n_symbols) {
+    Header header;
+    size_t bytes_eaten = get_header(data, n_data, header);
+    if (bytes_eaten == 0) {
+        return SymbolsResult{.success = false};
+    }
+    if (header.is_static) {
+        if (n_symbols < 3 * n_quats) {
+            return SymbolsResult{.success = false, .out_of_room = true};
+        }
+        std::fill(symbols, symbols + 3 * n_quats, 0);
+        return SymbolsResult{.success = true,
+                             .params = header.params,
+                             .bytes_eaten = bytes_eaten,
+                             .symbols_put = 3 * n_quats};
+    }
+
+    size_t symbols_put{};
+    bool out_of_room{};
+    auto on_triplet = [&](int8_t const* s) {
+        if (symbols_put + 3 > n_symbols) {
+            out_of_room = true;
+            return false;
+        }
+        std::copy(s, s + 3, symbols + symbols_put);
+        symbols_put += 3;
+        return true;
+    };
+    if (!decode_payload<kPadded>(header, data, n_data, bytes_eaten, n_quats, on_triplet)) {
+        return SymbolsResult{.success = false, .out_of_room = out_of_room};
+    }
+    return SymbolsResult{.success = true,
+                         .params = header.params,
+                         .bytes_eaten = bytes_eaten,
+                         .symbols_put = symbols_put};
+}
 
-        if (quant::dequant_one(state, s, qp)) {
+SymbolsResult decode_symbols(uint8_t const* data, size_t n_data, size_t n_quats,
+                             int8_t* symbols, size_t n_symbols) {
+    return decode_symbols_impl<false>(data, n_data, n_quats, symbols, n_symbols);
+}
+
+SymbolsResult decode_symbols_padded(uint8_t const* data, size_t n_data, size_t n_quats,
+                                    int8_t* symbols, size_t n_symbols) {
+    return decode_symbols_impl<true>(data, n_data, n_quats, symbols, n_symbols);
+}
+
+DecompressResult integrate_symbols(quant::State state, quant::Params const& params,
+                                   int8_t const* symbols, size_t n_symbols, quat::quat* quats,
+                                   size_t n_quats) {
+    size_t quats_put{};
+    for (size_t i = 0; i + 3 <= n_symbols; i += 3) {
+        quant::Step step = quant::dequant_one(state, symbols + i, params);
+        if (step == quant::Step::kInvalid) {
+            return DecompressResult{.success = false};
+        }
+        if (step == quant::Step::kSample) {
             if (quats_put >= n_quats) {
                 return DecompressResult{.success = false};
             }
@@ -112,10 +565,303 @@ DecompressResult decompress_block(quant::State state, uint8_t const* data, size_
             quats_put += 1;
         }
     }
-    if (own_cksum != cksum) {
+    return DecompressResult{
+        .success = true, .new_state = state, .bytes_eaten = 0, .quats_put = quats_put};
+}
+
+DecompressResult symbols_to_rates(quant::State state, quant::Params const& params,
+                                  int8_t const* symbols, size_t n_symbols, quat::vec* rates,
+                                  size_t n_rates) {
+    size_t rates_put{};
+    for (size_t i = 0; i + 3 <= n_symbols; i += 3) {
+        quant::Step step = quant::dequant_rate(state, symbols + i, params);
+        if (step == quant::Step::kInvalid) {
+            return DecompressResult{.success = false};
+        }
+        if (step == quant::Step::kSample) {
+            if (rates_put >= n_rates) {
+                return DecompressResult{.success = false};
+            }
+            rates[rates_put] = state.v;
+            rates_put += 1;
+        }
+    }
+    return DecompressResult{
+        .success = true, .new_state = state, .bytes_eaten = 0, .quats_put = rates_put};
+}
+
+// Accel payload: [shift] [i_var x | i_var y << 4] [i_var z] [u16 escape count]
+// [escaped samples, int16 each] [rANS, symbols in sample order, x y z]
+static constexpr int8_t kAccelEscape = -128;
+static constexpr size_t kAccelHeaderSize = 5;
+static constexpr uint8_t kMaxAccelShift = 15;
+
+static inline int round_shift(int v, uint8_t shift) {
+    if (shift == 0) {
+        return v;
+    }
+    int half = 1 << (shift - 1);
+    return v >= 0 ? (v + half) >> shift : -((-v + half) >> shift);
+}
+
+static inline int16_t clamp_i16(int v) {
+    return (int16_t)std::min(std::max(v, (int)INT16_MIN), (int)INT16_MAX);
+}
+
+size_t compress_accel(int16_t const* acc, size_t n_samples, uint8_t shift, uint8_t* data,
+                      size_t n_data) {
+    if (n_samples == 0 || n_samples > kMaxAccelSamples || shift > kMaxAccelShift ||
+        n_data < kAccelHeaderSize) {
+        return 0;
+    }
+    int8_t symbols[3 * kMaxAccelSamples];
+    int16_t escapes[3 * kMaxAccelSamples];
+    size_t n_escapes{};
+    int64_t sum[3]{};
+    size_t count[3]{};
+
+    int pred[3]{};
+    for (size_t i = 0; i < 3 * n_samples; ++i) {
+        int axis = i % 3;
+        int q = round_shift(acc[i] - pred[axis], shift);
+        if (q > -128 && q < 128) {
+            symbols[i] = q;
+            pred[axis] = clamp_i16(pred[axis] + q * (1 << shift));
+            sum[axis] += q * q;
+            count[axis] += 1;
+        } else {
+            symbols[i] = kAccelEscape;
+            escapes[n_escapes++] = acc[i];
+            pred[axis] = acc[i];
+        }
+    }
+
+    uint8_t i_var[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        i_var[axis] = model::var_to_ivar(count[axis] ? double(sum[axis]) / count[axis] : 0.0);
+    }
+
+    size_t n_head = kAccelHeaderSize + 2 * n_escapes;
+    if (n_data < n_head) {
+        return 0;
+    }
+    uint8_t* out = data + n_head;
+    size_t n_room = std::min(n_data - n_head, max_rans_size(3 * n_samples));
+    RansEncoder<> enc{.begin = out, .end = out + n_room};
+    for (size_t i = 3 * n_samples; i--;) {
+        enc.i_var = i_var[i % 3];
+        if (!enc.put(symbols[i])) {
+            return 0;
+        }
+    }
+    size_t rans_result = enc.finish();
+    if (rans_result == 0) {
+        return 0;
+    }
+    memmove(out, out + n_room - rans_result, rans_result);
+
+    data[0] = shift;
+    data[1] = i_var[0] | (i_var[1] << 4);
+    data[2] = i_var[2];
+    data[3] = (n_escapes >> 0) & 0xff;
+    data[4] = (n_escapes >> 8) & 0xff;
+    for (size_t i = 0; i < n_escapes; ++i) {
+        data[kAccelHeaderSize + 2 * i] = ((uint16_t)escapes[i] >> 0) & 0xff;
+        data[kAccelHeaderSize + 2 * i + 1] = ((uint16_t)escapes[i] >> 8) & 0xff;
+    }
+    return n_head + rans_result;
+}
+
+bool decompress_accel(uint8_t const* data, size_t n_data, int16_t* acc, size_t n_samples) {
+    if (n_data < kAccelHeaderSize + 4 || data[0] > kMaxAccelShift) {
+        return false;
+    }
+    uint8_t shift = data[0];
+    uint8_t i_var[3] = {(uint8_t)(data[1] & 0xf), (uint8_t)(data[1] >> 4), data[2]};
+    size_t n_escapes = data[3] | (data[4] << 8);
+    if (i_var[2] > 15 || n_data < kAccelHeaderSize + 2 * n_escapes + 4) {
+        return false;
+    }
+    uint8_t const* escapes = data + kAccelHeaderSize;
+
+    size_t bytes_eaten = kAccelHeaderSize + 2 * n_escapes;
+    uint8_t const* rdata = data + bytes_eaten;
+    uint32_t rstate = (((uint32_t)rdata[0]) << 0) | (((uint32_t)rdata[1]) << 8) |
+                      (((uint32_t)rdata[2]) << 16) | (((uint32_t)rdata[3]) << 24);
+    bytes_eaten += 4;
+    if (rstate < RANS_BYTE_L) {
+        return false;
+    }
+
+    size_t escapes_used{};
+    int pred[3]{};
+    for (size_t i = 0; i < 3 * n_samples; ++i) {
+        int axis = i % 3;
+        int8_t sym = rans_step(rstate, i_var[axis]);
+        while (rstate < RANS_BYTE_L) {
+            if (bytes_eaten >= n_data) {
+                return false;
+            }
+            rstate = (rstate << 8) | data[bytes_eaten];
+            bytes_eaten += 1;
+        }
+        if (sym == kAccelEscape) {
+            if (escapes_used >= n_escapes) {
+                return false;
+            }
+            uint8_t const* e = escapes + 2 * escapes_used;
+            pred[axis] = (int16_t)(e[0] | (e[1] << 8));
+            escapes_used += 1;
+        } else {
+            pred[axis] = clamp_i16(pred[axis] + sym * (1 << shift));
+        }
+        acc[i] = pred[axis];
+    }
+    return bytes_eaten == n_data && escapes_used == n_escapes;
+}
+
+void BlockDecoder::start(quant::State const& state, size_t n_quats) {
+    *this = BlockDecoder{};
+    phase_ = Phase::kHeader;
+    state_ = state;
+    n_quats_ = n_quats;
+}
+
+bool BlockDecoder::end_symbol(quat::quat* quats, size_t& quats_put) {
+    int8_t s[3];
+    if (!joint_) {
+        if (n_syms_ < 3) return true;
+        std::copy(syms_, syms_ + 3, s);
+    } else if (syms_[0] == kJointEscape) {
+        if (n_syms_ < 4) return true;
+        std::copy(syms_ + 1, syms_ + 4, s);
+    } else if (!joint_triplet(syms_[0], s)) {
+        return false;
+    }
+    n_syms_ = 0;
+    own_cksum_ += (uint8_t)s[0] + (uint8_t)s[1] + (uint8_t)s[2];
+
+    quant::Step step = quant::dequant_one(state_, s, params_);
+    if (step == quant::Step::kInvalid) {
+        return false;
+    }
+    if (step == quant::Step::kSample) {
+        quats[quats_put] = state_.q;
+        quats_put += 1;
+        samples_ += 1;
+    }
+    if (samples_ == n_quats_) {
+        if ((own_cksum_ & 0x7) != cksum_) {
+            return false;
+        }
+        phase_ = Phase::kDone;
+    }
+    return true;
+}
+
+DecompressResult BlockDecoder::feed(uint8_t const* data, size_t n_data, quat::quat* quats,
+                                    size_t n_quats) {
+    size_t bytes_eaten{};
+    size_t quats_put{};
+    auto fail = [&] {
+        phase_ = Phase::kFailed;
         return DecompressResult{.success = false};
+    };
+
+    bool stalled = false;
+    while (!stalled) {
+        switch (phase_) {
+            case Phase::kHeader: {
+                if (bytes_eaten == n_data) {
+                    stalled = true;
+                    break;
+                }
+                head_[n_head_++] = data[bytes_eaten++];
+                size_t n_params = 1 + ((head_[0] & kFlagAxisQp) ? 2 : 0) +
+                                  ((head_[0] & kFlagMode) ? 1 : 0);
+                if (n_head_ < n_params) {
+                    break;
+                }
+                Header header;
+                if (get_header(head_, n_head_, header) == 0) {
+                    return fail();
+                }
+                params_ = header.params;
+                joint_ = header.joint;
+                n_head_ = 0;
+                phase_ = header.is_static ? Phase::kStatic : Phase::kPayload;
+                break;
+            }
+            case Phase::kPayload:
+                if (bytes_eaten == n_data) {
+                    stalled = true;
+                    break;
+                }
+                head_[n_head_++] = data[bytes_eaten++];
+                if (n_head_ < 5) {
+                    break;
+                }
+                i_var_ = head_[0] & 0x1f;
+                cksum_ = head_[0] >> 5;
+                if (i_var_ > 15) {
+                    return fail();
+                }
+                rstate_ = (((uint32_t)head_[1]) << 0) | (((uint32_t)head_[2]) << 8) |
+                          (((uint32_t)head_[3]) << 16) | (((uint32_t)head_[4]) << 24);
+                if (rstate_ < RANS_BYTE_L) {
+                    return fail();
+                }
+                phase_ = Phase::kSymbol;
+                break;
+            case Phase::kStatic: {
+                static constexpr int8_t kZero[3]{};
+                if (samples_ == n_quats_) {
+                    phase_ = Phase::kDone;
+                    break;
+                }
+                if (quats_put == n_quats) {
+                    stalled = true;
+                    break;
+                }
+                if (quant::dequant_one(state_, kZero, params_) == quant::Step::kInvalid) {
+                    return fail();
+                }
+                quats[quats_put] = state_.q;
+                quats_put += 1;
+                samples_ += 1;
+                break;
+            }
+            case Phase::kSymbol:
+                // a triplet may complete a sample, only start one if there is room for it
+                if (n_syms_ == 0 && quats_put == n_quats) {
+                    stalled = true;
+                    break;
+                }
+                syms_[n_syms_++] = rans_step(rstate_, i_var_);
+                phase_ = Phase::kRenorm;
+                break;
+            case Phase::kRenorm:
+                while (rstate_ < RANS_BYTE_L && bytes_eaten < n_data) {
+                    rstate_ = (rstate_ << 8) | data[bytes_eaten];
+                    bytes_eaten += 1;
+                }
+                if (rstate_ < RANS_BYTE_L) {
+                    stalled = true;
+                    break;
+                }
+                phase_ = Phase::kSymbol;
+                if (!end_symbol(quats, quats_put)) {
+                    return fail();
+                }
+                break;
+            case Phase::kDone:
+                stalled = true;
+                break;
+            case Phase::kFailed:
+                return fail();
+        }
     }
     return DecompressResult{
-        .success = true, .new_state = state, .bytes_eaten = bytes_eaten, .quats_put = quats_put};
+        .success = true, .new_state = state_, .bytes_eaten = bytes_eaten, .quats_put = quats_put};
 }
 }  // namespace compress
\ No newline at end of file
@@ -16,10 +16,110 @@ struct DecompressResult {
     size_t quats_put;
 };
 
+struct SymbolsResult {
+    bool success;
+    quant::Params params;
+    size_t bytes_eaten;
+    size_t symbols_put;
+    // failed only for lack of room for the symbols
+    bool out_of_room;
+};
+
+// Symbols per sample the gyro data blocks of this library's writers stay within, beyond that
+// they fall back to coarser quantization. Decoders size their symbol buffers from it and grow
+// them for blocks that hold more, which writers given a larger scratch can produce.
+static constexpr size_t kMaxSymbolsPerSample = 12;
+
+// Largest payload compress_block and encode_symbols produce from n_symbols quantized updates.
+// With that much room the entropy coder skips its output checks.
+size_t max_payload_size(size_t n_symbols);
+
 CompressResult compress_block(quant::State state, quat::quat const* quats, size_t n_quats,
-                              uint8_t qp, uint8_t* data, size_t n_data, int8_t* scratch,
-                              size_t n_scratch);
+                              quant::Params const& params, uint8_t* data, size_t n_data,
+                              int8_t* scratch, size_t n_scratch,
+                              quant::Reconstruction const& recon = {});
+
+// Entropy codes the output of quant::quant_block, the second half of compress_block. Leaves
+// new_state untouched, so quantization can run ahead of entropy coding.
+CompressResult encode_symbols(quant::Params const& params, int8_t const* symbols,
+                              size_t n_symbols, uint8_t* data, size_t n_data);
+
+// Coarsens the per-axis qp of `base` for as long as the block stays within `max_err`.
+quant::Params choose_params(quant::State state, quat::quat const* quats, size_t n_quats,
+                            quant::Params base, quat::base_type max_err, int8_t* scratch,
+                            size_t n_scratch);
 
 DecompressResult decompress_block(quant::State state, uint8_t const* data, size_t n_data,
                                   quat::quat* quats, size_t n_quats);
+
+// The two halves of decompress_block. Entropy decoding does not depend on the quantizer state,
+// so blocks can be decoded ahead of (or in parallel with) the serial integration pass.
+SymbolsResult decode_symbols(uint8_t const* data, size_t n_data, size_t n_quats,
+                             int8_t* symbols, size_t n_symbols);
+
+// decode_symbols for callers that can read kDecodePadding bytes past n_data, e.g. the rest of
+// the file after a sized block. Input bounds are checked once per triplet instead of on every
+// byte; a block that runs past n_data still fails, and nothing past the padding is read.
+static constexpr size_t kDecodePadding = 8;
+
+SymbolsResult decode_symbols_padded(uint8_t const* data, size_t n_data, size_t n_quats,
+                                    int8_t* symbols, size_t n_symbols);
+
+DecompressResult integrate_symbols(quant::State state, quant::Params const& params,
+                                   int8_t const* symbols, size_t n_symbols, quat::quat* quats,
+                                   size_t n_quats);
+
+// integrate_symbols that outputs the angular velocity (state.v, radians per sample) of every
+// sample instead of the orientation. new_state.q is not updated.
+DecompressResult symbols_to_rates(quant::State state, quant::Params const& params,
+                                  int8_t const* symbols, size_t n_symbols, quat::vec* rates,
+                                  size_t n_rates);
+// Accel block payload: every axis is predicted from the previous reconstructed sample (0 for
+// the first one), the residuals are rounded to multiples of 2^shift and rANS coded with one
+// Laplace table per axis. Residuals outside the table range escape to the raw sample. Returns
+// the payload size, 0 if it does not fit. n_samples is at most kMaxAccelSamples.
+static constexpr size_t kMaxAccelSamples = 255;
+
+size_t compress_accel(int16_t const* acc, size_t n_samples, uint8_t shift, uint8_t* data,
+                      size_t n_data);
+
+// Reconstructs n_samples triplets, the payload must be consumed exactly.
+bool decompress_accel(uint8_t const* data, size_t n_data, int16_t* acc, size_t n_samples);
+
+// Resumable decompress_block for input that arrives in pieces. feed() returns as soon as it
+// runs out of input or of room for samples and picks up where it stopped on the next call, so
+// samples come out before the rest of the block has arrived. bytes_eaten and quats_put count
+// what a single call consumed and produced, new_state is not filled in, see state().
+class BlockDecoder {
+   public:
+    void start(quant::State const& state, size_t n_quats);
+
+    DecompressResult feed(uint8_t const* data, size_t n_data, quat::quat* quats, size_t n_quats);
+
+    // The block is complete, no further input belongs to it.
+    bool done() const { return phase_ == Phase::kDone; }
+    quant::State const& state() const { return state_; }
+
+   private:
+    enum class Phase : uint8_t { kHeader, kPayload, kStatic, kSymbol, kRenorm, kDone, kFailed };
+
+    // Called once the last decoded symbol is renormalized, completes a triplet if it can.
+    bool end_symbol(quat::quat* quats, size_t& quats_put);
+
+    Phase phase_{Phase::kFailed};
+    quant::State state_{};
+    quant::Params params_{};
+    bool joint_{};
+    size_t n_quats_{};
+    size_t samples_{};
+    // header or payload start (i_var byte and initial rANS state)
+    uint8_t head_[5]{};
+    size_t n_head_{};
+    uint8_t i_var_{};
+    uint8_t cksum_{};
+    uint8_t own_cksum_{};
+    uint32_t rstate_{};
+    int8_t syms_[4]{};
+    size_t n_syms_{};
+};
 }  // namespace compress
\ No newline at end of file
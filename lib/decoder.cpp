@@ -0,0 +1,499 @@
+#include "decoder.hpp"
+#include "bounded_queue.hpp"
+#include "compress.hpp"
+#include "reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace decoder {
+namespace {
+struct Item {
+    enum Kind { kGyro, kKeyframe, kEnd, kError } kind{kError};
+    quant::State keyframe{};
+    quant::Params params{};
+    std::vector<int8_t> symbols;
+};
+
+using reader::Setup;
+using reader::Streams;
+
+// Entropy decodes a gyro data block into `symbols`, growing it for blocks with more than
+// kMaxSymbolsPerSample symbols per sample.
+compress::SymbolsResult decode_block_symbols(uint8_t const* payload, size_t n_payload, bool padded,
+                                             uint16_t n_block, std::vector<int8_t>& symbols) {
+    auto decode = padded ? compress::decode_symbols_padded : compress::decode_symbols;
+    symbols.resize(compress::kMaxSymbolsPerSample * n_block);
+    for (;;) {
+        auto res = decode(payload, n_payload, n_block, symbols.data(), symbols.size());
+        if (!res.out_of_room) {
+            symbols.resize(res.success ? res.symbols_put : 0);
+            return res;
+        }
+        symbols.resize(2 * symbols.size());
+    }
+}
+
+// Walks the blocks from `pos` and entropy decodes gyro data, pushing one item per gyro or
+// keyframe block of `stream`.
+void scan(uint8_t const* data, size_t n_data, size_t pos, Streams streams, uint8_t stream,
+          BoundedQueue<Item>& queue) {
+    auto finish = [&](Item::Kind kind) {
+        queue.push(Item{.kind = kind});
+        queue.close();
+    };
+
+    while (pos < n_data) {
+        uint8_t const* p = data + pos;
+        size_t left = n_data - pos;
+        size_t size = 0;
+        Setup& setup = streams.setup[streams.current];
+        bool mine = streams.current == stream;
+        if (p[0] == reader::kGyroData) {
+            size_t prefix = reader::gyro_prefix_size(p, left, setup);
+            uint16_t n_block = reader::take_block_quats(setup);
+            if (n_block == 0 || prefix == 0) {
+                return finish(Item::kError);
+            }
+            size_t sized = reader::block_size(p, left, setup);
+            if (!mine && sized) {
+                pos += sized;
+                continue;
+            }
+            Item item{.kind = Item::kGyro};
+            // the end of the block is not known, the padded decode only works away from the
+            // end of the file
+            size_t n_payload = left - prefix;
+            compress::SymbolsResult res{};
+            if (n_payload > compress::kDecodePadding) {
+                res = decode_block_symbols(p + prefix, n_payload - compress::kDecodePadding, true,
+                                           n_block, item.symbols);
+            }
+            if (!res.success) {
+                res = decode_block_symbols(p + prefix, n_payload, false, n_block, item.symbols);
+            }
+            if (!res.success) {
+                return finish(Item::kError);
+            }
+            item.params = res.params;
+            size = prefix + res.bytes_eaten;
+            if (mine && !queue.push(std::move(item))) {
+                return;
+            }
+        } else {
+            size = reader::block_size(p, left, setup);
+            if (size == 0 || left < size || !reader::update_streams(p, streams)) {
+                return finish(Item::kError);
+            }
+            if (mine && p[0] == reader::kKeyframe &&
+                !queue.push(Item{.kind = Item::kKeyframe, .keyframe = reader::get_state(p + 1)})) {
+                return;
+            }
+        }
+        pos += size;
+    }
+    finish(Item::kEnd);
+}
+
+// Reads up to the first gyro data or keyframe block of `stream`, leaving `pos` there.
+bool read_setup(uint8_t const* data, size_t n_data, uint8_t stream, Streams& streams,
+                size_t& pos) {
+    reader::Reader reader(data, n_data);
+    reader.set_decode_stream(stream);
+    reader::Block block;
+    while (!reader.error() && reader.offset() < n_data) {
+        uint8_t id = data[reader.offset()];
+        bool mine = reader.stream() == stream;
+        if ((mine && (id == reader::kGyroData || id == reader::kKeyframe)) ||
+            !reader.next(block)) {
+            break;
+        }
+    }
+    streams = reader.streams();
+    pos = reader.offset();
+    return !reader.error();
+}
+
+size_t n_samples(GyroTrack const& track) { return track.quats.size(); }
+size_t n_samples(RateTrack const& track) { return track.rates.size(); }
+
+// Applies a keyframe or integrates a gyro block onto the track, keeping at most max_quats
+// samples. Returns false for an error item.
+bool append(GyroTrack& track, quant::State& state, Item const& item, size_t max_quats) {
+    if (item.kind == Item::kKeyframe) {
+        state = item.keyframe;
+    } else if (item.kind == Item::kGyro) {
+        size_t old_size = track.quats.size();
+        size_t n_quats = item.symbols.size() / 3;
+        track.quats.resize(old_size + n_quats);
+        auto res = compress::integrate_symbols(state, item.params, item.symbols.data(),
+                                               item.symbols.size(), &track.quats[old_size],
+                                               n_quats);
+        state = res.new_state;
+        track.quats.resize(std::min(old_size + res.quats_put, max_quats));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool append(RateTrack& track, quant::State& state, Item const& item, size_t max_quats) {
+    if (item.kind == Item::kKeyframe) {
+        state = item.keyframe;
+        track.anchors.push_back(RateTrack::Anchor{.sample = track.rates.size(), .q = state.q});
+    } else if (item.kind == Item::kGyro) {
+        size_t old_size = track.rates.size();
+        size_t n_rates = item.symbols.size() / 3;
+        track.rates.resize(old_size + n_rates);
+        auto res = compress::symbols_to_rates(state, item.params, item.symbols.data(),
+                                              item.symbols.size(), &track.rates[old_size],
+                                              n_rates);
+        state = res.new_state;
+        track.rates.resize(std::min(old_size + res.quats_put, max_quats));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// With length-prefixed gyro data the blocks are found without decoding them, so all of them
+// are entropy decoded in parallel while the calling thread integrates in order.
+template <typename Track>
+Track run_sized(uint8_t const* data, size_t n_data, size_t pos, quant::State state,
+                Streams streams, uint8_t stream, size_t max_quats) {
+    struct Job {
+        Item item;
+        uint8_t const* payload{};
+        size_t n_payload{};
+        uint16_t n_block{};
+    };
+
+    Track track{.samples_per_block = streams.setup[stream].samples_per_block};
+    std::vector<Job> jobs;
+    std::vector<int8_t> skipped;
+    size_t n_quats = 0;
+    bool ok = true;
+    while (pos < n_data && n_quats < max_quats) {
+        uint8_t const* p = data + pos;
+        size_t left = n_data - pos;
+        Setup& setup = streams.setup[streams.current];
+        bool mine = streams.current == stream;
+        size_t size = reader::block_size(p, left, setup);
+        if (p[0] == reader::kGyroData) {
+            size_t prefix = reader::gyro_prefix_size(p, left, setup);
+            uint16_t n_block = reader::take_block_quats(setup);
+            if (n_block == 0 || prefix == 0 || size > left || (mine && size == 0)) {
+                ok = false;
+                break;
+            }
+            if (size == 0) {
+                // unsized gyro data of another stream, its end is only found by decoding it
+                auto res = decode_block_symbols(p + prefix, left - prefix, false, n_block,
+                                                skipped);
+                if (!res.success) {
+                    ok = false;
+                    break;
+                }
+                size = prefix + res.bytes_eaten;
+            } else if (mine) {
+                jobs.push_back(Job{.item = Item{.kind = Item::kGyro},
+                                   .payload = p + prefix,
+                                   .n_payload = size - prefix,
+                                   .n_block = n_block});
+                n_quats += n_block;
+            }
+        } else if (size == 0 || size > left || !reader::update_streams(p, streams)) {
+            ok = false;
+            break;
+        } else if (mine && p[0] == reader::kKeyframe) {
+            jobs.push_back(Job{.item = Item{.kind = Item::kKeyframe,
+                                            .keyframe = reader::get_state(p + 1)}});
+        }
+        pos += size;
+    }
+
+    std::vector<bool> done(jobs.size());
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::atomic<size_t> next_job{0};
+    auto worker = [&]() {
+        for (size_t i; (i = next_job++) < jobs.size();) {
+            Job& job = jobs[i];
+            if (job.item.kind == Item::kGyro) {
+                // the rest of the file serves as padding, except for the last block
+                bool padded = job.payload + job.n_payload + compress::kDecodePadding <=
+                              data + n_data;
+                auto res = decode_block_symbols(job.payload, job.n_payload, padded, job.n_block,
+                                                job.item.symbols);
+                if (res.success &&
+                    reader::gyro_payload_complete(true, job.n_payload - res.bytes_eaten)) {
+                    job.item.params = res.params;
+                } else {
+                    job.item.kind = Item::kError;
+                }
+            }
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done[i] = true;
+            done_cv.notify_all();
+        }
+    };
+
+    unsigned n_threads = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    for (size_t i = 0; i < jobs.size() && ok; ++i) {
+        {
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done_cv.wait(lock, [&] { return done[i]; });
+        }
+        Item& item = jobs[i].item;
+        ok = append(track, state, item, max_quats);
+        std::vector<int8_t>().swap(item.symbols);
+    }
+    if (!ok) {
+        // let the workers run out of jobs
+        next_job = jobs.size();
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    track.success = ok || n_samples(track) >= max_quats;
+    return track;
+}
+
+template <typename Track>
+Track run(uint8_t const* data, size_t n_data, size_t pos, quant::State state,
+          Streams const& streams, uint8_t stream, size_t max_quats) {
+    if (streams.setup[stream].gyro_revision >= writer::kGyroRevisionSized) {
+        return run_sized<Track>(data, n_data, pos, state, streams, stream, max_quats);
+    }
+    Track track{.samples_per_block = streams.setup[stream].samples_per_block};
+    BoundedQueue<Item> queue(16);
+    std::thread scanner(scan, data, n_data, pos, streams, stream, std::ref(queue));
+
+    Item item;
+    while (n_samples(track) < max_quats && queue.pop(item)) {
+        if (item.kind == Item::kEnd || !append(track, state, item, max_quats)) {
+            track.success = item.kind == Item::kEnd;
+            break;
+        }
+    }
+    if (n_samples(track) >= max_quats) {
+        track.success = true;
+    }
+    queue.close();
+    scanner.join();
+    return track;
+}
+}  // namespace
+
+GyroTrack decode_gyro(uint8_t const* data, size_t n_data, uint8_t stream) {
+    Streams streams;
+    size_t pos;
+    if (stream >= reader::kMaxStreams || !read_setup(data, n_data, stream, streams, pos)) {
+        return GyroTrack{.success = false};
+    }
+    return run<GyroTrack>(data, n_data, pos, quant::State{}, streams, stream,
+                          std::numeric_limits<size_t>::max());
+}
+
+RateTrack decode_rates(uint8_t const* data, size_t n_data, uint8_t stream) {
+    Streams streams;
+    size_t pos;
+    if (stream >= reader::kMaxStreams || !read_setup(data, n_data, stream, streams, pos)) {
+        return RateTrack{.success = false};
+    }
+    auto track = run<RateTrack>(data, n_data, pos, quant::State{}, streams, stream,
+                                std::numeric_limits<size_t>::max());
+    track.anchors.insert(track.anchors.begin(), RateTrack::Anchor{});
+    return track;
+}
+
+quat::quat orientation_at(RateTrack const& track, size_t sample) {
+    auto anchor = std::upper_bound(
+        track.anchors.begin(), track.anchors.end(), sample,
+        [](size_t s, RateTrack::Anchor const& a) { return s < a.sample; });
+    if (anchor == track.anchors.begin()) {
+        return quat::quat{};
+    }
+    --anchor;
+    size_t end = std::min(sample + 1, track.rates.size());
+    if (anchor->sample >= end) {
+        return anchor->q;
+    }
+    return quant::integrate_rates(anchor->q, track.rates.data() + anchor->sample,
+                                  end - anchor->sample);
+}
+
+SeekResult seek(uint8_t const* data, size_t n_data, int64_t time_us) {
+    if (n_data < 7 + 13 || memcmp(data + n_data - 4, writer::kIndexMagic, 4) != 0) {
+        return SeekResult{.success = false};
+    }
+    size_t offset = reader::get_u32(data + n_data - 8);
+    if (offset + 5 > n_data || data[offset] != reader::kIndex) {
+        return SeekResult{.success = false};
+    }
+    reader::Block index{.id = reader::kIndex, .data = data + offset, .size = n_data - offset};
+    size_t n_entries = reader::index_size(index);
+    if (reader::block_size(index.data, index.size, Setup{}) != index.size || n_entries == 0) {
+        return SeekResult{.success = false};
+    }
+
+    // last entry with time <= time_us, or the first one
+    size_t l = 0, r = n_entries;
+    while (l + 1 < r) {
+        size_t mid = (l + r) / 2;
+        if (reader::index_entry(index, mid).time_us <= time_us) {
+            l = mid;
+        } else {
+            r = mid;
+        }
+    }
+    writer::IndexEntry entry = reader::index_entry(index, l);
+    if (entry.offset >= offset) {
+        return SeekResult{.success = false};
+    }
+    return SeekResult{.success = true,
+                      .sample = entry.sample,
+                      .time_us = entry.time_us,
+                      .offset = entry.offset,
+                      .state = entry.state};
+}
+
+GyroTrack decode_gyro_at(uint8_t const* data, size_t n_data, SeekResult const& at,
+                         size_t max_quats) {
+    Streams streams;
+    size_t pos;
+    if (!at.success || !read_setup(data, n_data, 0, streams, pos) || at.offset >= n_data) {
+        return GyroTrack{.success = false};
+    }
+    return run<GyroTrack>(data, n_data, at.offset, at.state, streams, 0, max_quats);
+}
+
+void StreamDecoder::push(uint8_t const* data, size_t n_data) {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+    pos_ = 0;
+    buffer_.insert(buffer_.end(), data, data + n_data);
+}
+
+size_t StreamDecoder::fail() {
+    error_ = true;
+    buffer_.clear();
+    pos_ = 0;
+    return 0;
+}
+
+void StreamDecoder::eat(size_t n) {
+    pos_ += n;
+    offset_ += n;
+}
+
+size_t StreamDecoder::pull(quat::quat* quats, size_t n_quats) {
+    size_t quats_put{};
+    while (!error_ && quats_put < n_quats) {
+        uint8_t const* p = buffer_.data() + pos_;
+        size_t left = buffer_.size() - pos_;
+        if (!started_) {
+            if (left < 7) {
+                break;
+            }
+            if (memcmp(p, "EspLog0", 7) != 0 || stream_ >= reader::kMaxStreams) {
+                return fail();
+            }
+            started_ = true;
+            eat(7);
+        } else if (skip_ > 0) {
+            if (left == 0) {
+                break;
+            }
+            size_t n = std::min(left, skip_);
+            eat(n);
+            skip_ -= n;
+        } else if (in_block_) {
+            auto res = discarding_
+                           ? block_.feed(p, left, discard_.data(), discard_.size())
+                           : block_.feed(p, sized_ ? std::min(left, left_) : left,
+                                         quats + quats_put, n_quats - quats_put);
+            if (!res.success) {
+                return fail();
+            }
+            eat(res.bytes_eaten);
+            if (!discarding_) {
+                quats_put += res.quats_put;
+            }
+            if (sized_) {
+                left_ -= res.bytes_eaten;
+            }
+            if (block_.done()) {
+                if (!reader::gyro_payload_complete(sized_, left_)) {
+                    return fail();
+                }
+                if (!discarding_) {
+                    state_ = block_.state();
+                }
+                in_block_ = false;
+            } else if (quats_put == n_quats) {
+                break;
+            } else if (sized_ && left_ == 0) {
+                // stalled for input that is not part of the block
+                return fail();
+            } else if (res.bytes_eaten == 0 && res.quats_put == 0) {
+                break;
+            }
+        } else if (left == 0) {
+            break;
+        } else if (p[0] == reader::kGyroData) {
+            reader::Setup& setup = streams_.setup[streams_.current];
+            size_t prefix = reader::gyro_prefix_size(p, left, setup);
+            if (prefix == 0) {
+                // the length may still be incomplete, it takes at most 4 bytes
+                if (left < 5) {
+                    break;
+                }
+                return fail();
+            }
+            if (setup.samples_per_block == 0) {
+                return fail();
+            }
+            sized_ = setup.gyro_revision >= writer::kGyroRevisionSized;
+            left_ = sized_ ? reader::block_size(p, left, setup) - prefix : 0;
+            uint16_t n_block = reader::take_block_quats(setup);
+            eat(prefix);
+            if (streams_.current != stream_ && sized_) {
+                skip_ = left_;
+                continue;
+            }
+            discarding_ = streams_.current != stream_;
+            if (discarding_) {
+                discard_.resize(64);
+            }
+            block_.start(state_, n_block);
+            in_block_ = true;
+        } else {
+            size_t size = reader::block_size(p, left, streams_.setup[streams_.current]);
+            if (size == 0) {
+                return fail();
+            }
+            if (size > left) {
+                break;
+            }
+            if (!reader::update_streams(p, streams_)) {
+                return fail();
+            }
+            if (p[0] == reader::kKeyframe && streams_.current == stream_) {
+                state_ = reader::get_state(p + 1);
+            }
+            eat(size);
+        }
+    }
+    return quats_put;
+}
+}  // namespace decoder
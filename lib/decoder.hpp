@@ -0,0 +1,104 @@
+#pragma once
+#include "compress.hpp"
+#include "fixquat.hpp"
+#include "quant.hpp"
+#include "reader.hpp"
+
+#include <vector>
+
+namespace decoder {
+struct GyroTrack {
+    bool success{};
+    uint16_t samples_per_block{};
+    std::vector<quat::quat> quats;
+};
+
+// Gyro track as angular velocity, for consumers that want rates rather than orientation. Skips
+// the per-sample quaternion integration, the orientation is recovered only where asked for.
+struct RateTrack {
+    bool success{};
+    uint16_t samples_per_block{};
+    // rotation from the previous sample to this one, axis times angle in radians
+    std::vector<quat::vec> rates;
+    // orientation before sample `sample`, at the start and at every keyframe
+    struct Anchor {
+        size_t sample{};
+        quat::quat q{};
+    };
+    std::vector<Anchor> anchors;
+};
+
+struct SeekResult {
+    bool success{};
+    uint32_t sample{};
+    int64_t time_us{};
+    size_t offset{};
+    quant::State state{};
+};
+
+// Decodes the gyro track of a whole EspLog file. With length-prefixed gyro data (revision 2)
+// all blocks are entropy decoded in parallel. Otherwise a scanner thread entropy decodes them
+// one after another, since that is the only way to find where each one ends. Either way the
+// calling thread runs the serial integration pass over the decoded symbols. In a multiplexed
+// file only the blocks of `stream` are decoded, the others are skipped.
+GyroTrack decode_gyro(uint8_t const* data, size_t n_data, uint8_t stream = 0);
+
+// decode_gyro without the orientation.
+RateTrack decode_rates(uint8_t const* data, size_t n_data, uint8_t stream = 0);
+
+// The orientation decode_gyro returns for `sample`, integrated from the nearest anchor before it.
+quat::quat orientation_at(RateTrack const& track, size_t sample);
+
+// Looks up the last seek point at or before `time_us` in the index block at the end of the
+// file. Fails if the file has no index. Seeking is for single stream files only.
+SeekResult seek(uint8_t const* data, size_t n_data, int64_t time_us);
+
+// Like decode_gyro, but starts at a seek point and stops after `max_quats` samples.
+GyroTrack decode_gyro_at(uint8_t const* data, size_t n_data, SeekResult const& at,
+                         size_t max_quats);
+
+// Pull decoder for a file that arrives in pieces, e.g. over a pipe or a socket. push() takes
+// fragments of any size, pull() returns every sample that can be decoded from what has arrived
+// so far, including the first samples of a gyro data block that is still incomplete. Only the
+// unconsumed tail of the input is kept, usually less than a block.
+class StreamDecoder {
+   public:
+    // Samples of other streams in a multiplexed file are skipped.
+    explicit StreamDecoder(uint8_t stream = 0) : stream_(stream) {}
+
+    void push(uint8_t const* data, size_t n_data);
+
+    // Writes up to n_quats samples and returns their count. Fewer than n_quats means that more
+    // input is needed, or that the stream is malformed if error() is set.
+    size_t pull(quat::quat* quats, size_t n_quats);
+
+    bool error() const { return error_; }
+    // Bytes of the stream consumed so far.
+    size_t offset() const { return offset_; }
+    reader::Setup const& setup() const { return streams_.setup[stream_]; }
+    quant::State const& state() const { return state_; }
+
+   private:
+    size_t fail();
+    void eat(size_t n);
+
+    std::vector<uint8_t> buffer_;
+    size_t pos_{};
+    size_t offset_{};
+    bool error_{};
+    bool started_{};
+    uint8_t stream_{};
+    reader::Streams streams_{};
+    quant::State state_{};
+    // inside a gyro data block, for sized blocks `left_` is what remains of its payload
+    bool in_block_{};
+    bool sized_{};
+    size_t left_{};
+    compress::BlockDecoder block_;
+    // gyro data of another stream: sized payloads are skipped, `skip_` bytes remain of it,
+    // unsized ones are decoded into `discard_`
+    size_t skip_{};
+    bool discarding_{};
+    std::vector<quat::quat> discard_;
+};
+}  // namespace decoder
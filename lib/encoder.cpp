@@ -0,0 +1,152 @@
+#include "encoder.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace encoder {
+Encoder::Encoder(Config const& config, Sink sink, ReconstructionSink recon_sink)
+    : config_(config),
+      sink_(std::move(sink)),
+      recon_sink_(std::move(recon_sink)),
+      pending_(config.samples_per_block),
+      scratch_(writer::gyro_scratch_size(config.samples_per_block, config.max_rate,
+                                         config.params)),
+      // header and setup, or stream select and gyro count in front of a block
+      out_(writer::max_gyro_data_size(config.samples_per_block, config.max_rate, config.params) +
+           16),
+      recon_quats_(recon_sink_ ? config.samples_per_block : 0),
+      recon_errors_(recon_sink_ ? config.samples_per_block : 0) {}
+
+bool Encoder::start() {
+    if (started_) {
+        return true;
+    }
+    started_ = true;
+    size_t n = config_.multiplexed
+                   ? writer::write_stream_select(config_.stream, out_.data(), out_.size())
+                   : writer::write_header(out_.data(), out_.size());
+    size_t n_setup = writer::write_gyro_setup(config_.samples_per_block, out_.data() + n,
+                                              out_.size() - n, config_.revision);
+    bool bad_index = config_.index && (config_.multiplexed || config_.sample_period_ns == 0 ||
+                                       config_.index_interval == 0);
+    if (n == 0 || n_setup == 0 || config_.samples_per_block == 0 || bad_index) {
+        failed_ = true;
+        return false;
+    }
+    n += n_setup;
+    if (config_.sample_period_ns != 0) {
+        n += writer::write_time_setup(config_.sample_period_ns, out_.data() + n, out_.size() - n);
+    }
+    emit(out_.data(), n);
+    return true;
+}
+
+void Encoder::emit(uint8_t const* data, size_t n) {
+    sink_(data, n);
+    offset_ += n;
+}
+
+bool Encoder::emit_block(quat::quat const* quats, size_t n_quats) {
+    // the stream id has been checked by start()
+    size_t n = config_.multiplexed
+                   ? writer::write_stream_select(config_.stream, out_.data(), out_.size())
+                   : 0;
+    if (config_.index && n_blocks_ % config_.index_interval == 0) {
+        // decoding resumes at the gyro count block in front of a short block
+        index_.push_back({.sample = (uint32_t)n_samples_,
+                          .time_us = (int64_t)(n_samples_ * config_.sample_period_ns / 1000),
+                          .offset = (uint32_t)(offset_ + n),
+                          .state = state_});
+    }
+    if (n_quats != config_.samples_per_block) {
+        n += writer::write_gyro_count(n_quats, out_.data() + n, out_.size() - n);
+    }
+    quant::Reconstruction recon{};
+    if (recon_sink_) {
+        recon = {.quats = recon_quats_.data(), .errors = recon_errors_.data()};
+    }
+    size_t n_block = writer::write_gyro_data(state_, quats, n_quats, out_.data() + n,
+                                             out_.size() - n, scratch_.data(), scratch_.size(),
+                                             config_.params, config_.max_err, config_.revision,
+                                             recon);
+    if (n_block == 0) {
+        failed_ = true;
+        return false;
+    }
+    emit(out_.data(), n + n_block);
+    n_samples_ += n_quats;
+    n_blocks_ += 1;
+    if (recon_sink_) {
+        recon_sink_(recon_quats_.data(), recon_errors_.data(), n_quats);
+    }
+    return true;
+}
+
+bool Encoder::push(quat::quat const* quats, size_t n_quats) {
+    if (failed_ || !start()) {
+        return false;
+    }
+    size_t spb = config_.samples_per_block;
+
+    // top up a partially filled block first
+    if (n_pending_ > 0) {
+        size_t n = std::min(n_quats, spb - n_pending_);
+        std::copy(quats, quats + n, pending_.data() + n_pending_);
+        n_pending_ += n;
+        quats += n;
+        n_quats -= n;
+        if (n_pending_ < spb) {
+            return true;
+        }
+        n_pending_ = 0;
+        if (!emit_block(pending_.data(), spb)) {
+            return false;
+        }
+    }
+
+    // whole blocks straight from the caller's buffer
+    for (; n_quats >= spb; quats += spb, n_quats -= spb) {
+        if (!emit_block(quats, spb)) {
+            return false;
+        }
+    }
+
+    std::copy(quats, quats + n_quats, pending_.data());
+    n_pending_ = n_quats;
+    return true;
+}
+
+bool Encoder::flush() {
+    if (failed_ || !start()) {
+        return false;
+    }
+    if (n_pending_ == 0) {
+        return true;
+    }
+    size_t n = n_pending_;
+    n_pending_ = 0;
+    return emit_block(pending_.data(), n);
+}
+
+bool Encoder::close() {
+    if (!flush()) {
+        return false;
+    }
+    failed_ = true;
+    if (!config_.index) {
+        return true;
+    }
+    // entries and the trailer hold 32 bit offsets and sample numbers
+    constexpr size_t kMax = std::numeric_limits<uint32_t>::max();
+    if (offset_ > kMax || n_samples_ > kMax) {
+        return false;
+    }
+    std::vector<uint8_t> out(1 + 4 + index_.size() * writer::kIndexEntrySize + 8);
+    size_t n = writer::write_index(index_.data(), index_.size(), offset_, out.data(), out.size());
+    if (n == 0) {
+        return false;
+    }
+    emit(out.data(), n);
+    return true;
+}
+}  // namespace encoder
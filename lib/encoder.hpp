@@ -0,0 +1,80 @@
+#pragma once
+#include "fixquat.hpp"
+#include "quant.hpp"
+#include "writer.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace encoder {
+struct Config {
+    uint16_t samples_per_block{512};
+    uint8_t revision{1};
+    // rounding, dead zone, predictor and quantization shifts, see writer::write_gyro_data
+    quant::Params params{writer::kGyroParams};
+    quat::base_type max_err{};
+    // largest rotation between two samples in radians, sizes the buffers, see
+    // writer::gyro_scratch_size
+    double max_rate{quant::kAnyRate};
+    // Leave the file header to the caller and start every piece handed to the sink with a
+    // stream select block, so that encoders for several streams can share one file.
+    bool multiplexed{};
+    uint8_t stream{};
+    // Nominal sample period, written as a time setup block if set.
+    uint32_t sample_period_ns{};
+    // Record a seek point in front of every index_interval-th gyro data block and write the
+    // index block on close(). Needs a file of one stream and sample_period_ns: the encoder
+    // writes no time delta blocks, so entries are timed at their nominal sample * period.
+    bool index{};
+    uint16_t index_interval{16};
+};
+
+// Push-style gyro encoder. Takes samples in chunks of any size, encodes them in blocks of
+// samples_per_block and hands every finished piece of the file (header and setup first) to
+// the sink. All buffers are sized up front, encoding a block does not allocate apart from
+// growing the index.
+class Encoder {
+   public:
+    using Sink = std::function<void(uint8_t const* data, size_t size)>;
+    // Gets the samples of every block as a decoder will reconstruct them, and the angle
+    // between each one and its input, right after the block went to the sink.
+    using ReconstructionSink = std::function<void(quat::quat const* quats,
+                                                  quat::base_type const* errors, size_t n)>;
+
+    Encoder(Config const& config, Sink sink, ReconstructionSink recon_sink = {});
+
+    // Returns false if a block could not be encoded, the encoder is unusable afterwards.
+    bool push(quat::quat const* quats, size_t n_quats);
+
+    // Encodes the buffered remainder as a short block.
+    bool flush();
+
+    // Flushes and writes the index block if there is one. The encoder takes no samples after.
+    bool close();
+
+    quant::State const& state() const { return state_; }
+
+   private:
+    bool start();
+    bool emit_block(quat::quat const* quats, size_t n_quats);
+    void emit(uint8_t const* data, size_t n);
+
+    Config config_;
+    Sink sink_;
+    ReconstructionSink recon_sink_;
+    bool started_{};
+    bool failed_{};
+    quant::State state_{};
+    std::vector<quat::quat> pending_;
+    size_t n_pending_{};
+    std::vector<int8_t> scratch_;
+    std::vector<uint8_t> out_;
+    std::vector<quat::quat> recon_quats_;
+    std::vector<quat::base_type> recon_errors_;
+    // bytes handed to the sink, samples and blocks encoded so far
+    size_t offset_{};
+    size_t n_samples_{};
+    size_t n_blocks_{};
+    std::vector<writer::IndexEntry> index_;
+};
+}  // namespace encoder
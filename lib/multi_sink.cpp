@@ -0,0 +1,306 @@
+#include "multi_sink.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && !defined(EBIN_NO_IO_URING)
+#define EBIN_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace sink {
+#ifdef EBIN_IO_URING
+// Bare kernel interface, so that liburing is not needed. Only this thread touches the rings.
+struct MultiSink::Ring {
+    int fd{-1};
+    void* sq_map{MAP_FAILED};
+    size_t sq_map_size{};
+    void* cq_map{MAP_FAILED};
+    size_t cq_map_size{};
+    io_uring_sqe* sqes{(io_uring_sqe*)MAP_FAILED};
+    size_t sqes_size{};
+
+    unsigned* sq_tail{};
+    unsigned sq_mask{};
+    unsigned* sq_array{};
+    unsigned* cq_head{};
+    unsigned* cq_tail{};
+    unsigned cq_mask{};
+    io_uring_cqe* cqes{};
+    // the pool is registered, writes use IORING_OP_WRITE_FIXED
+    bool fixed{};
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_map_size);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_size);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params p{};
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0) {
+            return false;
+        }
+        sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+        }
+        sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) {
+            return false;
+        }
+        cq_map = single ? sq_map
+                        : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (cq_map == MAP_FAILED || sqes == MAP_FAILED) {
+            return false;
+        }
+
+        uint8_t* sq = (uint8_t*)sq_map;
+        uint8_t* cq = (uint8_t*)cq_map;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    bool register_buffers(uint8_t* pool, size_t n_buffers, size_t buffer_size) {
+        std::vector<iovec> iov(n_buffers);
+        for (size_t i = 0; i < n_buffers; ++i) {
+            iov[i] = iovec{.iov_base = pool + i * buffer_size, .iov_len = buffer_size};
+        }
+        fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov.data(),
+                        (unsigned)n_buffers) == 0;
+        return fixed;
+    }
+
+    // There is always room: no more sqes are queued than there are buffers.
+    void push(int buffer, int file, uint8_t const* data, size_t size, uint64_t offset) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = file;
+        sqe->off = offset;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = (uint32_t)size;
+        sqe->buf_index = fixed ? buffer : 0;
+        sqe->user_data = buffer;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete) {
+        unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+};
+#else
+struct MultiSink::Ring {};
+#endif
+
+MultiSink::MultiSink(MultiOptions const& options)
+    : options_(options),
+      pool_(options.n_buffers * options.buffer_size),
+      writes_(options.n_buffers) {
+    for (size_t i = options_.n_buffers; i--;) {
+        free_.push_back((int)i);
+    }
+#ifdef EBIN_IO_URING
+    if (options_.use_uring && options_.n_buffers > 0) {
+        auto ring = std::make_unique<Ring>();
+        if (ring->init((unsigned)options_.n_buffers)) {
+            // unregistered buffers still work, only with a copy per write
+            ring->register_buffers(pool_.data(), options_.n_buffers, options_.buffer_size);
+            ring_ = std::move(ring);
+        }
+    }
+#endif
+}
+
+MultiSink::~MultiSink() { close(); }
+
+int MultiSink::open(char const* path) {
+    int fd = ::open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    streams_.push_back(Stream{.fd = fd});
+    return (int)streams_.size() - 1;
+}
+
+int MultiSink::take_buffer() {
+    while (free_.empty()) {
+        if (in_flight_ == 0) {
+            // every buffer is held by a stream, write out the fullest one early
+            Stream* fullest = nullptr;
+            for (Stream& s : streams_) {
+                if (s.buffer >= 0 && (!fullest || s.fill > fullest->fill)) {
+                    fullest = &s;
+                }
+            }
+            if (!fullest) {
+                return -1;
+            }
+            queue(*fullest);
+        } else if (!reap(1)) {
+            return -1;
+        }
+    }
+    int i = free_.back();
+    free_.pop_back();
+    return i;
+}
+
+uint8_t* MultiSink::reserve(int stream, size_t size) {
+    Stream& s = streams_[stream];
+    if (error_ || size > options_.buffer_size) {
+        return nullptr;
+    }
+    if (s.buffer >= 0 && s.fill + size > options_.buffer_size) {
+        queue(s);
+    }
+    if (s.buffer < 0) {
+        s.buffer = take_buffer();
+        s.fill = 0;
+        if (s.buffer < 0) {
+            error_ = true;
+            return nullptr;
+        }
+    }
+    return buffer(s.buffer) + s.fill;
+}
+
+void MultiSink::commit(int stream, size_t size) { streams_[stream].fill += size; }
+
+bool MultiSink::write(int stream, uint8_t const* data, size_t size) {
+    while (size > 0) {
+        size_t chunk = std::min(size, options_.buffer_size);
+        uint8_t* p = reserve(stream, chunk);
+        if (!p) {
+            return false;
+        }
+        memcpy(p, data, chunk);
+        commit(stream, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+void MultiSink::queue(Stream& stream) {
+    int i = stream.buffer;
+    writes_[i] = Write{.stream = (int)(&stream - streams_.data()),
+                       .offset = stream.offset,
+                       .size = stream.fill};
+    stream.offset += stream.fill;
+    stream.buffer = -1;
+    stream.fill = 0;
+    issue(i);
+}
+
+void MultiSink::issue(int i) {
+    Write& w = writes_[i];
+    int fd = streams_[w.stream].fd;
+#ifdef EBIN_IO_URING
+    if (ring_) {
+        ring_->push(i, fd, buffer(i) + w.done, w.size - w.done, w.offset + w.done);
+        to_submit_ += 1;
+        in_flight_ += 1;
+        return;
+    }
+#endif
+    while (w.done < w.size) {
+        ssize_t n = pwrite(fd, buffer(i) + w.done, w.size - w.done, w.offset + w.done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error_ = true;
+            break;
+        }
+        w.done += n;
+    }
+    free_.push_back(i);
+}
+
+bool MultiSink::reap(unsigned min_complete) {
+#ifdef EBIN_IO_URING
+    if (to_submit_ > 0 || min_complete > 0) {
+        int n = ring_->enter(to_submit_, min_complete);
+        if (n < 0 && errno != EINTR) {
+            error_ = true;
+            return false;
+        }
+        to_submit_ -= n > 0 ? n : 0;
+    }
+    unsigned head = *ring_->cq_head;
+    unsigned tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        io_uring_cqe const& cqe = ring_->cqes[head & ring_->cq_mask];
+        int i = (int)cqe.user_data;
+        Write& w = writes_[i];
+        in_flight_ -= 1;
+        if (cqe.res <= 0) {
+            error_ = true;
+            free_.push_back(i);
+            continue;
+        }
+        w.done += cqe.res;
+        if (w.done < w.size) {
+            // short write, queue the rest
+            issue(i);
+        } else {
+            free_.push_back(i);
+        }
+    }
+    __atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+#else
+    (void)min_complete;
+#endif
+    return !error_;
+}
+
+bool MultiSink::submit() { return !ring_ || reap(0); }
+
+bool MultiSink::close() {
+    for (Stream& s : streams_) {
+        if (s.buffer >= 0 && s.fill > 0) {
+            queue(s);
+        } else if (s.buffer >= 0) {
+            free_.push_back(s.buffer);
+            s.buffer = -1;
+        }
+    }
+    while (ring_ && in_flight_ > 0) {
+        if (!reap(1)) {
+            break;
+        }
+    }
+    for (Stream& s : streams_) {
+        if (s.fd >= 0 && ::close(s.fd) != 0) {
+            error_ = true;
+        }
+        s.fd = -1;
+    }
+    return !error_;
+}
+}  // namespace sink
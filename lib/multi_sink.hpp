@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace sink {
+struct MultiOptions {
+    size_t buffer_size{1 << 16};
+    // shared by all streams, also bounds the number of writes in flight. With fewer buffers
+    // than streams, partially filled ones get written out early.
+    size_t n_buffers{64};
+    bool use_uring{true};
+};
+
+// Writes many log files from a single thread. Every stream fills buffers from a shared pool;
+// full buffers are queued as positional writes and go to the kernel in batches through one
+// io_uring, with the pool registered as fixed buffers so the kernel does not have to map them
+// again for every write. Callers can encode straight into the pool with reserve/commit.
+// Without io_uring (not compiled in, disabled, or refused by the kernel) the queued buffers are
+// written with pwrite right away.
+class MultiSink {
+   public:
+    explicit MultiSink(MultiOptions const& options);
+    ~MultiSink();
+    MultiSink(MultiSink const&) = delete;
+    MultiSink& operator=(MultiSink const&) = delete;
+
+    // Creates or truncates a file, returns its stream id or -1.
+    int open(char const* path);
+
+    // Room for at least `size` bytes at the end of the stream, to encode into directly.
+    // Returns nullptr if size exceeds buffer_size or after an error. Only valid until the next
+    // call on this sink.
+    uint8_t* reserve(int stream, size_t size);
+    void commit(int stream, size_t size);
+
+    // reserve, copy and commit.
+    bool write(int stream, uint8_t const* data, size_t size);
+
+    // Hands all queued buffers to the kernel with a single system call.
+    bool submit();
+
+    // Writes out the partially filled buffers, waits for every write and closes all files.
+    bool close();
+
+    bool uses_uring() const { return ring_ != nullptr; }
+    bool error() const { return error_; }
+
+   private:
+    struct Ring;
+    struct Stream {
+        int fd{-1};
+        int buffer{-1};
+        size_t fill{};
+        uint64_t offset{};
+    };
+    // the write a buffer is queued for
+    struct Write {
+        int stream{};
+        uint64_t offset{};
+        size_t size{};
+        size_t done{};
+    };
+
+    uint8_t* buffer(int i) { return pool_.data() + i * options_.buffer_size; }
+    int take_buffer();
+    void queue(Stream& stream);
+    void issue(int i);
+    bool reap(unsigned min_complete);
+
+    MultiOptions options_;
+    std::vector<uint8_t> pool_;
+    std::vector<int> free_;
+    std::vector<Write> writes_;
+    std::vector<Stream> streams_;
+    std::unique_ptr<Ring> ring_;
+    unsigned to_submit_{};
+    unsigned in_flight_{};
+    bool error_{};
+};
+}  // namespace sink
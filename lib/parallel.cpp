@@ -0,0 +1,190 @@
+#include "parallel.hpp"
+#include "bounded_queue.hpp"
+#include "compress.hpp"
+#include "writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace parallel {
+// The state a segment starting at quats[start] begins with. It is taken from the input rather
+// than from the previous segment's reconstruction, so segments do not wait on each other.
+static quant::State keyframe_state(quat::quat const* quats, size_t start) {
+    quant::State state{};
+    if (start >= 1) {
+        state.q = quats[start - 1];
+    }
+    if (start >= 2) {
+        state.v = (quats[start - 2].conj() * quats[start - 1]).axis_angle();
+    }
+    return state;
+}
+
+static bool encode_segment(quat::quat const* quats, size_t start, size_t n_blocks,
+                           uint16_t samples_per_block, std::vector<uint8_t>& out) {
+    std::vector<int8_t> scratch(writer::gyro_scratch_size(samples_per_block));
+    std::vector<uint8_t> buf(writer::max_gyro_data_size(samples_per_block));
+
+    quant::State state = keyframe_state(quats, start);
+    size_t n = writer::write_keyframe(state, buf.data(), buf.size());
+    out.insert(out.end(), buf.data(), buf.data() + n);
+
+    for (size_t i = 0; i < n_blocks; ++i) {
+        n = writer::write_gyro_data(state, quats + start + i * samples_per_block,
+                                    samples_per_block, buf.data(), buf.size(), scratch.data(),
+                                    scratch.size());
+        if (n == 0) {
+            return false;
+        }
+        out.insert(out.end(), buf.data(), buf.data() + n);
+    }
+    return true;
+}
+
+EncodeResult encode_gyro(quat::quat const* quats, size_t n_quats, uint16_t samples_per_block,
+                         size_t keyframe_interval, unsigned n_threads) {
+    if (samples_per_block == 0 || keyframe_interval == 0) {
+        return EncodeResult{.success = false};
+    }
+    size_t n_blocks = n_quats / samples_per_block;
+    size_t n_segments = (n_blocks + keyframe_interval - 1) / keyframe_interval;
+
+    std::vector<std::vector<uint8_t>> segments(n_segments);
+    std::atomic<size_t> next_segment{0};
+    std::atomic<bool> failed{false};
+    auto worker = [&]() {
+        for (size_t seg; (seg = next_segment++) < n_segments && !failed;) {
+            size_t first = seg * keyframe_interval;
+            size_t count = std::min(keyframe_interval, n_blocks - first);
+            if (!encode_segment(quats, first * samples_per_block, count, samples_per_block,
+                                segments[seg])) {
+                failed = true;
+            }
+        }
+    };
+
+    n_threads = std::max(1U, std::min<unsigned>(n_threads, n_segments));
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (failed) {
+        return EncodeResult{.success = false};
+    }
+
+    EncodeResult result{.success = true, .quats_used = n_blocks * samples_per_block};
+    size_t total = 0;
+    for (auto const& seg : segments) {
+        total += seg.size();
+    }
+    result.data.reserve(total);
+    for (auto const& seg : segments) {
+        result.data.insert(result.data.end(), seg.begin(), seg.end());
+    }
+    return result;
+}
+EncodeResult encode_gyro_pipelined(quant::State state, quat::quat const* quats, size_t n_quats,
+                                   uint16_t samples_per_block, quant::Params const& params,
+                                   unsigned n_workers) {
+    if (samples_per_block == 0) {
+        return EncodeResult{.success = false};
+    }
+    size_t n_blocks = n_quats / samples_per_block;
+    size_t n_scratch = std::min(quant::max_symbols(samples_per_block, params),
+                                compress::kMaxSymbolsPerSample * samples_per_block);
+
+    struct Job {
+        size_t index{};
+        std::vector<int8_t> symbols;
+    };
+    struct Done {
+        bool success{};
+        std::vector<uint8_t> data;
+    };
+
+    BoundedQueue<Job> jobs(2 * std::max(1U, n_workers));
+    std::vector<Done> done(n_blocks);
+    std::vector<bool> is_done(n_blocks);
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::atomic<bool> failed{false};
+
+    auto finish = [&](size_t index, Done result) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done[index] = std::move(result);
+        is_done[index] = true;
+        done_cv.notify_all();
+    };
+
+    auto quantizer = [&]() {
+        for (size_t i = 0; i < n_blocks && !failed; ++i) {
+            Job job{.index = i, .symbols = std::vector<int8_t>(n_scratch)};
+            auto res = quant::quant_block(state, quats + i * samples_per_block, samples_per_block,
+                                          params, job.symbols.data(), job.symbols.size());
+            if (!res.success) {
+                finish(i, Done{.success = false});
+                break;
+            }
+            state = res.new_state;
+            job.symbols.resize(res.bytes_put);
+            if (!jobs.push(std::move(job))) {
+                break;
+            }
+        }
+        jobs.close();
+    };
+
+    auto worker = [&]() {
+        std::vector<uint8_t> buf(1 + compress::max_payload_size(n_scratch));
+        Job job;
+        while (jobs.pop(job)) {
+            buf[0] = 3;  // block id
+            auto res = compress::encode_symbols(params, job.symbols.data(), job.symbols.size(),
+                                                buf.data() + 1, buf.size() - 1);
+            Done result{.success = res.success};
+            if (res.success) {
+                result.data.assign(buf.data(), buf.data() + res.bytes_put + 1);
+            }
+            finish(job.index, std::move(result));
+        }
+    };
+
+    std::thread quantizer_thread(quantizer);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::max(1U, n_workers); ++i) {
+        workers.emplace_back(worker);
+    }
+
+    // reassemble in block order while the pipeline runs
+    EncodeResult result{.success = true, .quats_used = n_blocks * samples_per_block};
+    for (size_t i = 0; i < n_blocks; ++i) {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&] { return is_done[i]; });
+        Done block = std::move(done[i]);
+        lock.unlock();
+        if (!block.success) {
+            result = EncodeResult{.success = false};
+            failed = true;
+            jobs.close();
+            break;
+        }
+        result.data.insert(result.data.end(), block.data.begin(), block.data.end());
+    }
+
+    quantizer_thread.join();
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (result.success) {
+        result.new_state = state;
+    }
+    return result;
+}
+}  // namespace parallel
@@ -0,0 +1,29 @@
+#pragma once
+#include "fixquat.hpp"
+#include "quant.hpp"
+
+#include <vector>
+
+namespace parallel {
+struct EncodeResult {
+    bool success{};
+    size_t quats_used{};
+    quant::State new_state{};
+    std::vector<uint8_t> data;
+};
+
+// Encodes whole blocks of `samples_per_block` quats into keyframe (0x08) and gyro data (0x03)
+// blocks. A keyframe starts every run of `keyframe_interval` blocks, and the runs are encoded
+// concurrently on up to `n_threads` threads. Trailing quats that do not fill a block are left
+// unused.
+EncodeResult encode_gyro(quat::quat const* quats, size_t n_quats, uint16_t samples_per_block,
+                         size_t keyframe_interval, unsigned n_threads);
+
+// Encodes whole blocks into gyro data (0x03) blocks, byte identical to calling
+// compress_block serially with `params`. One thread quantizes, since the quantizer state is
+// serial, and `n_workers` threads entropy code the finished blocks. The output is put back
+// together in block order.
+EncodeResult encode_gyro_pipelined(quant::State state, quat::quat const* quats, size_t n_quats,
+                                   uint16_t samples_per_block, quant::Params const& params,
+                                   unsigned n_workers);
+}  // namespace parallel
@@ -2,50 +2,112 @@
 #include "fixquat.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 
 namespace quant {
-static inline single_update quant_update(quat::vec update, int8_t scale) {
-    int8_t ux = update.x.raw_value() >> scale;
-    int8_t uy = update.y.raw_value() >> scale;
-    int8_t uz = update.z.raw_value() >> scale;
-
-    using T = decltype(update.x);
-    if (ux != (update.x.raw_value() >> scale) || ux == -128) ux = update.x < T{0} ? -127 : 127;
-    if (uy != (update.y.raw_value() >> scale) || uy == -128) uy = update.y < T{0} ? -127 : 127;
-    if (uz != (update.z.raw_value() >> scale) || uz == -128) uz = update.z < T{0} ? -127 : 127;
-    return single_update{ux, uy, uz};
+static inline int32_t quant_component(int32_t raw, int scale, Params const& params) {
+    switch (params.rounding) {
+        case Rounding::kNearest: {
+            int64_t half = scale ? (int64_t{1} << (scale - 1)) : 0;
+            return int32_t(std::clamp<int64_t>((raw + half) >> scale, -128, 128));
+        }
+        case Rounding::kDeadZone: {
+            int64_t mag = std::abs(int64_t{raw});
+            int64_t ofs = ((int64_t{1} << scale) * (4 - params.dead_zone)) / 8;
+            int64_t q = std::clamp<int64_t>((mag + ofs) >> scale, 0, 128);
+            return int32_t(raw < 0 ? -q : q);
+        }
+        default:
+            return int32_t(std::clamp<int64_t>(raw >> scale, -128, 128));
+    }
+}
+
+static inline int32_t dequant_component(int8_t q, int scale, Params const& params) {
+    if (params.rounding == Rounding::kDeadZone && q != 0) {
+        // reconstruct at the middle of the (shifted) bin
+        int32_t mag = (std::abs((int)q) << scale) + ((1 << scale) * params.dead_zone) / 8;
+        return q < 0 ? -mag : mag;
+    }
+    return ((int)q) << scale;
 }
 
-static inline quat::vec dequant_update(single_update update, int8_t scale) {
+static inline single_update quant_update(quat::vec update, Params const& params) {
+    int32_t q[3] = {quant_component(update.x.raw_value(), params.qp[0], params),
+                    quant_component(update.y.raw_value(), params.qp[1], params),
+                    quant_component(update.z.raw_value(), params.qp[2], params)};
+    for (auto& c : q) {
+        if (c < -127 || c > 127) c = c < 0 ? -127 : 127;
+    }
+    return single_update{int8_t(q[0]), int8_t(q[1]), int8_t(q[2])};
+}
+
+static inline quat::vec dequant_update(single_update update, Params const& params) {
     using R = quat::base_type;
-    return {R::from_raw_value(((int)update.x) << scale),
-            R::from_raw_value(((int)update.y) << scale),
-            R::from_raw_value(((int)update.z) << scale)};
+    return {R::from_raw_value(dequant_component(update.x, params.qp[0], params)),
+            R::from_raw_value(dequant_component(update.y, params.qp[1], params)),
+            R::from_raw_value(dequant_component(update.z, params.qp[2], params))};
 }
 
-QuantResult quant_block(State state, quat::quat const* quats, size_t n_quats, uint8_t qp,
-                               int8_t* out, size_t n_out) {
+static inline quat::vec predict_increment(quat::vec dv, Params const& params) {
+    using R = quat::base_type;
+    switch (params.predictor) {
+        case Predictor::kLinear:
+            return dv;
+        case Predictor::kHalf:
+            return {R::from_raw_value(dv.x.raw_value() >> 1),
+                    R::from_raw_value(dv.y.raw_value() >> 1),
+                    R::from_raw_value(dv.z.raw_value() >> 1)};
+        default:
+            return {};
+    }
+}
+
+// state.dv holds the full velocity increment of the current sample
+static inline void advance(State& state, Params const& params) {
+    state.v = state.v + state.dv;
+    state.q = (state.q * quat::quat(state.v)).normalized();
+    state.dv = predict_increment(state.dv, params);
+}
+
+size_t max_symbols(size_t n_quats, Params const& params, double max_rate) {
+    double step = std::ldexp(1.0, *std::min_element(params.qp, params.qp + 3) - 27);
+    // The reconstruction stays within a step per axis of the rate it quantized, take 4 for the
+    // rotation since the previous reconstruction. The predicted one (v + dv) is 1, 2 or 3
+    // reconstructed rates for the constant, damped and linear predictor.
+    double rate = std::min(max_rate, kAnyRate) + 4 * step;
+    int n_pred = params.predictor == Predictor::kLinear ? 3
+                 : params.predictor == Predictor::kHalf ? 2
+                                                        : 1;
+    double update = rate + n_pred * (rate + step);
+    size_t triplets = size_t(update / (127 * step)) + 2;
+    return 3 * triplets * n_quats;
+}
+
+QuantResult quant_block(State state, quat::quat const* quats, size_t n_quats,
+                        Params const& params, int8_t* out, size_t n_out,
+                        Reconstruction const& recon) {
     size_t bytes_put = 0;
     quat::base_type max_ang_err = {};
 
     for (size_t i = 0; i < n_quats; ++i) {
         // compute angular acceleration update
         quat::quat q_update = state.q.conj() * quats[i];
-        quat::vec v_update = q_update.axis_angle() - state.v;
+        quat::vec v_update = q_update.axis_angle() - (state.v + state.dv);
 
         // quantize update
         quat::vec sum{};
         bool correction_needed{true};
         while (correction_needed) {
-            auto update_quanted = quant_update(v_update, qp);
-            auto update_dequanted = dequant_update(update_quanted, qp);
+            auto update_quanted = quant_update(v_update, params);
+            auto update_dequanted = dequant_update(update_quanted, params);
 
             sum = sum + update_dequanted;
             v_update = v_update - update_dequanted;
 
             correction_needed = update_quanted.is_saturated();
 
-            if (bytes_put > n_out) {
+            if (bytes_put + 3 > n_out) {
                 return QuantResult{.success = false};
             }
             out[bytes_put + 0] = update_quanted.x;
@@ -55,26 +117,94 @@ QuantResult quant_block(State state, quat::quat const* quats, size_t n_quats, ui
         }
 
         // update state
-        state.v = state.v + sum;
-        state.q = (state.q * quat::quat(state.v)).normalized();
+        state.dv = state.dv + sum;
+        advance(state, params);
 
         // update max quantization error
-        max_ang_err = std::max((state.q.conj() * quats[i]).axis_angle().norm(), max_ang_err);
+        quat::base_type err = (state.q.conj() * quats[i]).axis_angle().norm();
+        max_ang_err = std::max(err, max_ang_err);
+        if (recon.quats) {
+            recon.quats[i] = state.q;
+        }
+        if (recon.errors) {
+            recon.errors[i] = err;
+        }
     }
 
     return QuantResult{
         .success = true, .new_state = state, .bytes_put = bytes_put, .max_ang_err = max_ang_err};
 }
 
-bool dequant_one(State& state, int8_t* data, uint8_t qp) {
+// Bounds of v and dv. The rate quant_block reconstructs is within a step per axis of a
+// rotation of at most kAnyRate, its increment within twice that per axis. They leave room for a
+// single update below 1 (kMaxQp) and keep every sum, and the squared angle quat(v) takes, below
+// the fixed-point limit of 16.
+static constexpr int32_t kMaxRateRaw = int32_t((kAnyRate + 0.5) * (1 << 27));
+static constexpr int32_t kMaxIncrementRaw = 2 * kMaxRateRaw;
+
+static inline bool in_range(quat::vec const& v, int32_t limit) {
+    int32_t c[3] = {v.x.raw_value(), v.y.raw_value(), v.z.raw_value()};
+    return -limit <= c[0] && c[0] <= limit && -limit <= c[1] && c[1] <= limit &&
+           -limit <= c[2] && c[2] <= limit;
+}
+
+static inline bool rate_in_range(quat::vec const& v) {
+    if (!in_range(v, kMaxRateRaw)) {
+        return false;
+    }
+    int64_t c[3] = {v.x.raw_value(), v.y.raw_value(), v.z.raw_value()};
+    return c[0] * c[0] + c[1] * c[1] + c[2] * c[2] <= int64_t{kMaxRateRaw} * kMaxRateRaw;
+}
+
+// q is normalized after every sample, but may come from a keyframe or an index entry.
+static inline bool near_unit(quat::quat const& q) {
+    constexpr int64_t kOne = int64_t{1} << 27;
+    int64_t c[4] = {q.w.raw_value(), q.x.raw_value(), q.y.raw_value(), q.z.raw_value()};
+    for (int64_t x : c) {
+        if (x < -2 * kOne || x > 2 * kOne) {
+            return false;
+        }
+    }
+    int64_t norm_squared = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3];
+    return kOne * kOne / 4 <= norm_squared && norm_squared <= 4 * kOne * kOne;
+}
+
+// Adds the update to dv, returns kSample once the sample can be integrated safely.
+static inline Step add_update(State& state, int8_t const* data, Params const& params) {
+    if (!rate_in_range(state.v) || !in_range(state.dv, kMaxIncrementRaw)) {
+        return Step::kInvalid;
+    }
     single_update upd{.x = data[0], .y = data[1], .z = data[2]};
-    state.v = state.v + dequant_update(upd, qp);
+    state.dv = state.dv + dequant_update(upd, params);
+    if (upd.is_saturated()) {
+        return Step::kSaturated;
+    }
+    bool valid = rate_in_range(state.v + state.dv) && near_unit(state.q);
+    return valid ? Step::kSample : Step::kInvalid;
+}
+
+Step dequant_one(State& state, int8_t const* data, Params const& params) {
+    Step step = add_update(state, data, params);
+    if (step == Step::kSample) {
+        advance(state, params);
+    }
+    return step;
+}
+
+Step dequant_rate(State& state, int8_t const* data, Params const& params) {
+    Step step = add_update(state, data, params);
+    if (step == Step::kSample) {
+        state.v = state.v + state.dv;
+        state.dv = predict_increment(state.dv, params);
+    }
+    return step;
+}
 
-    if (!upd.is_saturated()) {
-        state.q = (state.q * quat::quat(state.v)).normalized();
-        return true;
+quat::quat integrate_rates(quat::quat q, quat::vec const* rates, size_t n_rates) {
+    for (size_t i = 0; i < n_rates; ++i) {
+        q = (q * quat::quat(rates[i])).normalized();
     }
-    return false;
+    return q;
 }
 
 }  // namespace quant
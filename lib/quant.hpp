@@ -8,9 +8,32 @@ struct single_update {
     bool is_saturated() const { return abs(x) == 127 || abs(y) == 127 || abs(z) == 127; };
 };
 
+enum class Rounding : uint8_t {
+    kFloor = 0,     // plain right shift, legacy behaviour
+    kNearest = 1,   // round to nearest
+    kDeadZone = 2,  // round to nearest with a widened zero bin
+};
+
+enum class Predictor : uint8_t {
+    kConstant = 0,  // constant angular velocity, legacy behaviour
+    kLinear = 1,    // linear extrapolation of angular velocity
+    kHalf = 2,      // linear extrapolation, damped by 1/2
+};
+
+struct Params {
+    // quantization shift for x, y and z
+    uint8_t qp[3]{};
+    Rounding rounding{Rounding::kFloor};
+    // zero bin widening in 1/8 of a step, 0..7 (kDeadZone only)
+    uint8_t dead_zone{};
+    Predictor predictor{Predictor::kConstant};
+};
+
 struct State {
     quat::quat q;
     quat::vec v;
+    // velocity increment predicted for the next sample
+    quat::vec dv;
 };
 
 struct QuantResult {
@@ -20,9 +43,46 @@ struct QuantResult {
     quat::base_type max_ang_err{};
 };
 
-QuantResult quant_block(State state, quat::quat const* quats, size_t n_quats, uint8_t qp,
-                        int8_t* out, size_t n_out);
+// Optional per-sample outputs of quant_block, each null or room for n_quats entries: the
+// orientation a decoder reconstructs (bit exact) and its angle to the input, so the encoded
+// data can be checked without decoding it again.
+struct Reconstruction {
+    quat::quat* quats{};
+    quat::base_type* errors{};
+};
+
+// Largest rotation between two samples axis_angle can report.
+static constexpr double kAnyRate = 3.14159265358979323846;
+
+// Upper bound of the symbols quant_block emits for n_quats samples, if the rotation from one
+// input sample to the next stays below max_rate radians. Saturated updates repeat in steps of
+// 127 << qp until the rest fits, so the bound grows with max_rate >> qp.
+size_t max_symbols(size_t n_quats, Params const& params, double max_rate = kAnyRate);
+
+// Coarsest quantization shift. With coarser steps a run of saturated updates could leave the
+// fixed-point range before the state checks of dequant_one catch it.
+static constexpr uint8_t kMaxQp = 20;
+
+QuantResult quant_block(State state, quat::quat const* quats, size_t n_quats,
+                        Params const& params, int8_t* out, size_t n_out,
+                        Reconstruction const& recon = {});
+
+enum class Step : uint8_t {
+    kSaturated,  // more triplets follow for this sample
+    kSample,     // the sample is complete
+    kInvalid,    // the state left what any encoder produces, the data is corrupt
+};
+
+// Takes one triplet of symbols. The state is only integrated while every axis of v stays
+// within kAnyRate (plus a margin) and dv within twice that, so that corrupt data cannot
+// overflow the fixed-point arithmetic.
+Step dequant_one(State& state, int8_t const* data, Params const& params);
+
+// dequant_one without the integration: v and dv advance, q is left as it is.
+Step dequant_rate(State& state, int8_t const* data, Params const& params);
 
-bool dequant_one(State& state, int8_t* data, uint8_t qp);
+// Integrates the per-sample rotations (state.v after every sample) onto q exactly like
+// dequant_one, so the result matches the decoded orientation bit for bit.
+quat::quat integrate_rates(quat::quat q, quat::vec const* rates, size_t n_rates);
 
 }  // namespace quant
\ No newline at end of file
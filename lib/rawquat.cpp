@@ -0,0 +1,88 @@
+#include "rawquat.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace rawquat {
+MappedQuats::MappedQuats(char const* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        failed_ = true;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        size_ = st.st_size / sizeof(quat::quat);
+        map_bytes_ = size_ * sizeof(quat::quat);
+    } else {
+        failed_ = true;
+    }
+    if (map_bytes_ > 0) {
+        void* map = mmap(nullptr, map_bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            failed_ = true;
+            size_ = 0;
+        } else {
+            map_ = map;
+            madvise(map_, map_bytes_, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+MappedQuats::~MappedQuats() {
+    if (map_) {
+        munmap(map_, map_bytes_);
+    }
+}
+
+QuatStream::QuatStream(char const* path, size_t window) {
+    // windows start on page boundaries, which quat records never straddle
+    size_t page_quats = sysconf(_SC_PAGESIZE) / sizeof(quat::quat);
+    window_ = std::max<size_t>(1, (window + page_quats - 1) / page_quats) * page_quats;
+
+    fd_ = open(path, O_RDONLY);
+    struct stat st;
+    if (fd_ >= 0 && fstat(fd_, &st) == 0) {
+        size_ = st.st_size / sizeof(quat::quat);
+    }
+}
+
+QuatStream::~QuatStream() {
+    unmap();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void QuatStream::unmap() {
+    if (map_) {
+        munmap(map_, map_bytes_);
+        map_ = nullptr;
+    }
+}
+
+bool QuatStream::next(quat::quat const*& quats, size_t& n_quats) {
+    unmap();
+    if (fd_ < 0 || pos_ >= size_) {
+        return false;
+    }
+    size_t count = std::min(window_, size_ - pos_);
+    map_bytes_ = count * sizeof(quat::quat);
+    void* map = mmap(nullptr, map_bytes_, PROT_READ, MAP_PRIVATE, fd_, pos_ * sizeof(quat::quat));
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    map_ = map;
+    madvise(map_, map_bytes_, MADV_SEQUENTIAL);
+    madvise(map_, map_bytes_, MADV_WILLNEED);
+    quats = (quat::quat const*)map_;
+    n_quats = count;
+    pos_ += count;
+    return true;
+}
+}  // namespace rawquat
@@ -0,0 +1,52 @@
+#pragma once
+#include "fixquat.hpp"
+
+#include <cstddef>
+
+namespace rawquat {
+// Read-only memory mapping of a .rawquat file (packed quat::quat records). A trailing partial
+// record is ignored.
+class MappedQuats {
+   public:
+    explicit MappedQuats(char const* path);
+    ~MappedQuats();
+    MappedQuats(MappedQuats const&) = delete;
+    MappedQuats& operator=(MappedQuats const&) = delete;
+
+    bool valid() const { return !failed_; }
+    quat::quat const* data() const { return (quat::quat const*)map_; }
+    size_t size() const { return size_; }
+
+   private:
+    void* map_{};
+    size_t map_bytes_{};
+    size_t size_{};
+    bool failed_{};
+};
+
+// Walks a .rawquat file through a sliding mapping of `window` quats, so only one window is
+// mapped at a time regardless of the file size.
+class QuatStream {
+   public:
+    explicit QuatStream(char const* path, size_t window = 1 << 20);
+    ~QuatStream();
+    QuatStream(QuatStream const&) = delete;
+    QuatStream& operator=(QuatStream const&) = delete;
+
+    bool valid() const { return fd_ >= 0; }
+
+    // Maps the next chunk. The pointer stays valid until the following call. Returns false at
+    // the end of the file or on error.
+    bool next(quat::quat const*& quats, size_t& n_quats);
+
+   private:
+    void unmap();
+
+    int fd_{-1};
+    size_t size_{};
+    size_t pos_{};
+    size_t window_{};
+    void* map_{};
+    size_t map_bytes_{};
+};
+}  // namespace rawquat
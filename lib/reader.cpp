@@ -0,0 +1,306 @@
+#include "reader.hpp"
+#include "bitpack.hpp"
+#include "compress.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace reader {
+uint32_t get_u32(uint8_t const* p) {
+    return ((uint32_t)p[0] << 0) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static quat::base_type get_raw(uint8_t const* p) {
+    return quat::base_type::from_raw_value((int32_t)get_u32(p));
+}
+
+quant::State get_state(uint8_t const* p) {
+    quant::State state;
+    state.q = {get_raw(p + 0), get_raw(p + 4), get_raw(p + 8), get_raw(p + 12)};
+    state.v = {get_raw(p + 16), get_raw(p + 20), get_raw(p + 24)};
+    state.dv = {get_raw(p + 28), get_raw(p + 32), get_raw(p + 36)};
+    return state;
+}
+
+// LEB128, at most 4 bytes. Returns the number of bytes read, 0 if malformed.
+static size_t get_varint(uint8_t const* p, size_t left, size_t& value) {
+    value = 0;
+    for (size_t i = 0; i < 4 && i < left; ++i) {
+        value |= (size_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t gyro_prefix_size(uint8_t const* p, size_t left, Setup const& setup) {
+    if (setup.gyro_revision < writer::kGyroRevisionSized) {
+        return 1;
+    }
+    size_t length;
+    size_t n = get_varint(p + 1, left - 1, length);
+    return n ? 1 + n : 0;
+}
+
+bool gyro_payload_complete(bool sized, size_t n_left) {
+    // sized blocks must decode to exactly their length, unsized ones end where decoding does
+    return !sized || n_left == 0;
+}
+
+size_t block_size(uint8_t const* p, size_t left, Setup const& setup) {
+    switch (p[0]) {
+        case kGyroData: {
+            size_t prefix = gyro_prefix_size(p, left, setup);
+            size_t length;
+            if (prefix <= 1 || !get_varint(p + 1, left - 1, length)) {
+                return 0;
+            }
+            return prefix + length;
+        }
+        case kGyroSetup:
+            return 4;
+        case kTime:
+        case kGlobalTime:
+            return 5;
+        case kAccelSetup:
+            return 3;
+        case kAccelData:
+            return 1 + 6 * setup.accel_block_size;
+        case kAccelCompressed:
+        case kAccelPacked:
+            return left >= 3 ? 3 + (p[1] | (p[2] << 8)) : 3;
+        case kImuOrient:
+            return 4;
+        case kGyroCount:
+            return 3;
+        case kTimeSetup:
+            return 5;
+        case kStreamSelect:
+            return 2;
+        case kTimeDelta: {
+            size_t value;
+            size_t n = get_varint(p + 1, left - 1, value);
+            // an incomplete varint is reported as a truncated block
+            return n ? 1 + n : (left < 5 ? left + 1 : 0);
+        }
+        case kKeyframe:
+            return 41;
+        case kIndex:
+            return left >= 5 ? 1 + 4 + get_u32(p + 1) * writer::kIndexEntrySize + 8 : 5;
+        default:
+            return 0;
+    }
+}
+
+void update_setup(uint8_t const* p, Setup& setup) {
+    switch (p[0]) {
+        case kGyroSetup:
+            setup.gyro_revision = p[1];
+            setup.samples_per_block = p[2] | (p[3] << 8);
+            break;
+        case kAccelSetup:
+            setup.accel_block_size = p[1];
+            setup.accel_range = p[2];
+            break;
+        case kGyroCount:
+            setup.short_block = p[1] | (p[2] << 8);
+            break;
+        case kTimeSetup:
+            setup.sample_period_ns = get_u32(p + 1);
+            break;
+        case kTimeDelta: {
+            size_t zigzag;
+            get_varint(p + 1, 4, zigzag);
+            setup.time_delta_us = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            break;
+        }
+    }
+}
+
+bool update_streams(uint8_t const* p, Streams& streams) {
+    if (p[0] == kStreamSelect) {
+        if (p[1] >= kMaxStreams) {
+            return false;
+        }
+        streams.current = p[1];
+    } else {
+        update_setup(p, streams.setup[streams.current]);
+    }
+    return true;
+}
+
+uint16_t take_block_quats(Setup& setup) {
+    uint16_t n = setup.short_block ? setup.short_block : setup.samples_per_block;
+    setup.short_block = 0;
+    return n;
+}
+
+int64_t take_block_duration_ns(Setup& setup, size_t n_block) {
+    int64_t duration = (int64_t)n_block * setup.sample_period_ns + setup.time_delta_us * 1000LL;
+    setup.time_delta_us = 0;
+    return std::max<int64_t>(duration, 0);
+}
+
+void sample_times_us(int64_t start_ns, int64_t duration_ns, size_t n, int64_t* times) {
+    if (n == 0) {
+        return;
+    }
+    // t_k = start + k * step, with step in us as 48.16 fixed point
+    int64_t start = start_ns / 1000;
+    int64_t step = (duration_ns << 16) / (1000 * (int64_t)n);
+    size_t k = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_set_epi64x(step, 0);
+    __m128i inc = _mm_set1_epi64x(2 * step);
+    __m128i base = _mm_set1_epi64x(start);
+    for (; k + 2 <= n; k += 2) {
+        _mm_storeu_si128((__m128i*)(times + k), _mm_add_epi64(base, _mm_srli_epi64(acc, 16)));
+        acc = _mm_add_epi64(acc, inc);
+    }
+#endif
+    for (; k < n; ++k) {
+        times[k] = start + (((int64_t)k * step) >> 16);
+    }
+}
+
+uint32_t time_elapsed_us(Block const& block) { return get_u32(block.data + 1); }
+
+int32_t global_time_us(Block const& block) { return (int32_t)get_u32(block.data + 1); }
+
+void imu_orient(Block const& block, char* orient) { memcpy(orient, block.data + 1, 3); }
+
+int16_t accel_value(Block const& block, size_t sample, int axis) {
+    uint8_t const* p = block.data + 1 + 2 * (3 * sample + axis);
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+bool accel_values(Block const& block, Setup const& setup, int16_t* acc) {
+    size_t n = setup.accel_block_size;
+    if (block.id == kAccelCompressed) {
+        return compress::decompress_accel(block.data + 3, block.size - 3, acc, n);
+    }
+    if (block.id == kAccelPacked) {
+        return bitpack::unpack_accel(block.data + 3, block.size - 3, acc, n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            acc[3 * i + axis] = accel_value(block, i, axis);
+        }
+    }
+    return true;
+}
+
+quant::State keyframe_state(Block const& block) { return get_state(block.data + 1); }
+
+size_t index_size(Block const& block) { return get_u32(block.data + 1); }
+
+writer::IndexEntry index_entry(Block const& block, size_t i) {
+    uint8_t const* p = block.data + 5 + i * writer::kIndexEntrySize;
+    return writer::IndexEntry{
+        .sample = get_u32(p),
+        .time_us = (int64_t)(get_u32(p + 4) | ((uint64_t)get_u32(p + 8) << 32)),
+        .offset = get_u32(p + 12),
+        .state = get_state(p + 16)};
+}
+
+Reader::Reader(uint8_t const* data, size_t n_data) : data_(data), n_data_(n_data) {
+    if (n_data < 7 || memcmp(data, "EspLog0", 7) != 0) {
+        error_ = true;
+        pos_ = n_data;
+    } else {
+        pos_ = 7;
+    }
+}
+
+bool Reader::fail() {
+    error_ = true;
+    pos_ = n_data_;
+    return false;
+}
+
+bool Reader::next(Block& block) {
+    if (pos_ >= n_data_) {
+        return false;
+    }
+    uint8_t const* p = data_ + pos_;
+    size_t left = n_data_ - pos_;
+    size_t size = 0;
+    Setup& setup = streams_.setup[streams_.current];
+    Chain& chain = chains_[streams_.current];
+    if (p[0] == kGyroData) {
+        size_t prefix = gyro_prefix_size(p, left, setup);
+        uint16_t n_block = take_block_quats(setup);
+        if (n_block == 0 || n_block > quats_.size() || prefix == 0) {
+            return fail();
+        }
+        block_start_ns_ = chain.clock_ns;
+        block_duration_ns_ = take_block_duration_ns(setup, n_block);
+        chain.clock_ns += block_duration_ns_;
+        size_t sized = block_size(p, left, setup);
+        if (sized > left) {
+            return fail();
+        }
+        n_quats_ = 0;
+        bool decode = decode_gyro_ && (decode_stream_ < 0 || decode_stream_ == streams_.current);
+        if (sized && !decode) {
+            size = sized;
+        } else {
+            size_t n_payload = sized ? sized - prefix : left - prefix;
+            auto res = compress::decompress_block(chain.state, p + prefix, n_payload,
+                                                  quats_.data(), n_block);
+            if (!res.success || !gyro_payload_complete(sized, n_payload - res.bytes_eaten)) {
+                return fail();
+            }
+            chain.state = res.new_state;
+            n_quats_ = res.quats_put;
+            size = prefix + res.bytes_eaten;
+        }
+    } else {
+        size = block_size(p, left, setup);
+        if (size == 0 || size > left || !update_streams(p, streams_)) {
+            return fail();
+        }
+        if (p[0] == kGyroSetup) {
+            quats_.resize(std::max<size_t>(quats_.size(), setup.samples_per_block));
+        } else if (p[0] == kKeyframe) {
+            chain.state = get_state(p + 1);
+        }
+    }
+    block = Block{.id = p[0], .data = p, .size = size, .stream = streams_.current};
+    pos_ += size;
+    return true;
+}
+
+Cursor::Cursor(uint8_t const* data, size_t n_data, uint8_t stream)
+    : reader_(data, n_data), stream_(stream) {
+    reader_.set_decode_stream(stream);
+}
+
+bool Cursor::next(Block& block) {
+    while (reader_.next(block)) {
+        if (block.id != kStreamSelect && block.stream == stream_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_gyro(uint8_t const* data, size_t n_data, std::vector<quat::quat>& quats,
+               uint8_t stream) {
+    Cursor cursor(data, n_data, stream);
+    Block block;
+    while (cursor.next(block)) {
+        if (block.id == kGyroData) {
+            auto const& reader = cursor.reader();
+            quats.insert(quats.end(), reader.quats(), reader.quats() + reader.n_quats());
+        }
+    }
+    return !cursor.reader().error();
+}
+}  // namespace reader
@@ -0,0 +1,182 @@
+#pragma once
+#include "fixquat.hpp"
+#include "quant.hpp"
+#include "writer.hpp"
+
+#include <vector>
+
+namespace reader {
+enum BlockId : uint8_t {
+    kGyroSetup = 0x01,
+    kTime = 0x02,
+    kGyroData = 0x03,
+    kAccelSetup = 0x04,
+    kAccelData = 0x05,
+    kGlobalTime = 0x06,
+    kImuOrient = 0x07,
+    kKeyframe = 0x08,
+    kIndex = 0x09,
+    kGyroCount = 0x0a,
+    kAccelCompressed = 0x0b,
+    kAccelPacked = 0x0c,
+    kTimeSetup = 0x0d,
+    kTimeDelta = 0x0e,
+    kStreamSelect = 0x0f,
+};
+
+// Everything from the setup blocks that is needed to find block boundaries.
+struct Setup {
+    uint8_t gyro_revision{};
+    uint16_t samples_per_block{};
+    uint8_t accel_block_size{};
+    uint8_t accel_range{};
+    // sample count of the next gyro data block if it is a short one, 0 otherwise
+    uint16_t short_block{};
+    // nominal gyro sample period, 0 without a time setup block
+    uint32_t sample_period_ns{};
+    // duration delta of the next gyro data block
+    int32_t time_delta_us{};
+};
+
+// Applies setup and gyro count blocks to `setup`, other blocks are ignored.
+void update_setup(uint8_t const* p, Setup& setup);
+
+static constexpr size_t kMaxStreams = writer::kMaxStreams;
+
+// Setups of all streams of a multiplexed file. The blocks after a stream select block belong to
+// the selected stream; files without one carry only stream 0.
+struct Streams {
+    Setup setup[kMaxStreams]{};
+    uint8_t current{};
+};
+
+// update_setup for the current stream, or a stream switch. Returns false for a stream id out of
+// range.
+bool update_streams(uint8_t const* p, Streams& streams);
+
+// Sample count of the next gyro data block, consumes a pending short block count.
+uint16_t take_block_quats(Setup& setup);
+
+// Duration of the next gyro data block with n_block samples, consumes a pending time delta.
+int64_t take_block_duration_ns(Setup& setup, size_t n_block);
+
+// Timestamps of n samples spread evenly over a block, in us.
+void sample_times_us(int64_t start_ns, int64_t duration_ns, size_t n, int64_t* times);
+
+// A block inside the caller's buffer, id byte included.
+struct Block {
+    uint8_t id{};
+    uint8_t const* data{};
+    size_t size{};
+    // for a stream select block the stream selected by it
+    uint8_t stream{};
+};
+
+// Size of a block, 0 for unknown ids and for gyro data without a length prefix (revision 1).
+// The result may exceed `left` if the block is truncated.
+size_t block_size(uint8_t const* p, size_t left, Setup const& setup);
+
+// Bytes in front of the compressed payload of a gyro data block: the id and, from revision 2
+// on, the length. 0 if the length is malformed.
+size_t gyro_prefix_size(uint8_t const* p, size_t left, Setup const& setup);
+
+// Whether a finished gyro data block ended where it should, given the `n_left` bytes of its
+// payload that decoding did not consume.
+bool gyro_payload_complete(bool sized, size_t n_left);
+
+// Typed views, each expects a block with the matching id.
+uint32_t time_elapsed_us(Block const& block);
+int32_t global_time_us(Block const& block);
+void imu_orient(Block const& block, char* orient);
+int16_t accel_value(Block const& block, size_t sample, int axis);
+// All samples of a raw, compressed or packed accel block, setup.accel_block_size triplets.
+bool accel_values(Block const& block, Setup const& setup, int16_t* acc);
+quant::State keyframe_state(Block const& block);
+size_t index_size(Block const& block);
+writer::IndexEntry index_entry(Block const& block, size_t i);
+
+uint32_t get_u32(uint8_t const* p);
+
+// Raw state layout shared by keyframe and index blocks, 40 bytes.
+quant::State get_state(uint8_t const* p);
+
+// Zero-copy block iterator over a whole EspLog file. Gyro data blocks are decoded while
+// iterating, since their size is only known afterwards; the quantizer state is carried from
+// block to block and reset by keyframes, separately for every stream.
+class Reader {
+   public:
+    Reader(uint8_t const* data, size_t n_data);
+
+    // Moves to the next block. Returns false at the end of the data or if a block is malformed,
+    // the latter sets error().
+    bool next(Block& block);
+
+    // With length-prefixed gyro data, skip decoding it. The quantizer state is not advanced
+    // then, only keyframes make it valid again.
+    void set_decode_gyro(bool decode) { decode_gyro_ = decode; }
+
+    // Skip decoding it for all streams but `stream`.
+    void set_decode_stream(uint8_t stream) { decode_stream_ = stream; }
+
+    bool error() const { return error_; }
+    size_t offset() const { return pos_; }
+    // The stream of the block last returned by next() and its setup and quantizer state.
+    uint8_t stream() const { return streams_.current; }
+    Setup const& setup() const { return streams_.setup[streams_.current]; }
+    Streams const& streams() const { return streams_; }
+    quant::State const& state() const { return chains_[streams_.current].state; }
+
+    // Samples of the gyro data block last returned by next().
+    quat::quat const* quats() const { return quats_.data(); }
+    size_t n_quats() const { return n_quats_; }
+
+    // Start and duration of that block according to the time setup and time delta blocks,
+    // counted from the first gyro data block.
+    int64_t block_start_ns() const { return block_start_ns_; }
+    int64_t block_duration_ns() const { return block_duration_ns_; }
+
+    // One timestamp per sample of that block, n_quats() of them.
+    void sample_times_us(int64_t* times) const {
+        reader::sample_times_us(block_start_ns_, block_duration_ns_, n_quats_, times);
+    }
+
+   private:
+    bool fail();
+
+    uint8_t const* data_;
+    size_t n_data_;
+    size_t pos_{};
+    bool error_{};
+    bool decode_gyro_{true};
+    int decode_stream_{-1};
+    Streams streams_{};
+    struct Chain {
+        quant::State state{};
+        int64_t clock_ns{};
+    };
+    Chain chains_[kMaxStreams]{};
+    std::vector<quat::quat> quats_;
+    size_t n_quats_{};
+    int64_t block_start_ns_{};
+    int64_t block_duration_ns_{};
+};
+
+// Demultiplexes a file: next() only returns the blocks of one stream, stream select blocks
+// excluded. Sized gyro data blocks of the other streams are skipped without decoding.
+class Cursor {
+   public:
+    Cursor(uint8_t const* data, size_t n_data, uint8_t stream);
+
+    bool next(Block& block);
+
+    Reader const& reader() const { return reader_; }
+
+   private:
+    Reader reader_;
+    uint8_t stream_;
+};
+
+// Serial decode of the whole gyro track of one stream with Cursor.
+bool read_gyro(uint8_t const* data, size_t n_data, std::vector<quat::quat>& quats,
+               uint8_t stream = 0);
+}  // namespace reader
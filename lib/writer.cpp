@@ -1,6 +1,8 @@
 #include "writer.hpp"
+#include "bitpack.hpp"
 #include "compress.hpp"
 
+#include <algorithm>
 #include <limits>
 
 namespace writer {
@@ -12,12 +14,13 @@ size_t write_header(uint8_t* out, size_t n_out) {
     return 7;
 }
 
-size_t write_gyro_setup(uint16_t samples_per_block, uint8_t* out, size_t n_out) {
+size_t write_gyro_setup(uint16_t samples_per_block, uint8_t* out, size_t n_out,
+                        uint8_t revision) {
     if (n_out < 4) {
         return 0;
     }
     out[0] = 1;  // block id
-    out[1] = 1;  // revision
+    out[1] = revision;
     out[2] = (samples_per_block >> 0) & 0xff;
     out[3] = (samples_per_block >> 8) & 0xff;
     return 4;
@@ -35,23 +38,94 @@ size_t write_time_block(uint32_t time_elapsed_us, uint8_t* out, size_t n_out) {
     return 5;
 }
 
+size_t write_time_setup(uint32_t sample_period_ns, uint8_t* out, size_t n_out) {
+    if (n_out < 5) {
+        return 0;
+    }
+    out[0] = 0x0d;  // block id
+    out[1] = (sample_period_ns >> 0) & 0xff;
+    out[2] = (sample_period_ns >> 8) & 0xff;
+    out[3] = (sample_period_ns >> 16) & 0xff;
+    out[4] = (sample_period_ns >> 24) & 0xff;
+    return 5;
+}
+
+size_t write_time_delta(int32_t delta_us, uint8_t* out, size_t n_out) {
+    if (delta_us <= -kMaxTimeDelta || delta_us >= kMaxTimeDelta) {
+        return 0;
+    }
+    uint32_t zigzag = ((uint32_t)delta_us << 1) ^ (uint32_t)(delta_us >> 31);
+    size_t n = 1;
+    do {
+        if (n >= n_out) {
+            return 0;
+        }
+        out[n++] = (zigzag & 0x7f) | (zigzag > 0x7f ? 0x80 : 0);
+        zigzag >>= 7;
+    } while (zigzag);
+    out[0] = 0x0e;  // block id
+    return n;
+}
+
+size_t gyro_scratch_size(size_t n_quats, double max_rate, quant::Params const& params) {
+    return std::min(quant::max_symbols(n_quats, params, max_rate),
+                    compress::kMaxSymbolsPerSample * n_quats);
+}
+
+size_t max_gyro_data_size(size_t n_quats, double max_rate, quant::Params const& params) {
+    return 1 + kGyroLengthBytes +
+           compress::max_payload_size(gyro_scratch_size(n_quats, max_rate, params));
+}
+
 size_t write_gyro_data(quant::State& state, quat::quat const* quats, size_t n_quats, uint8_t* data,
-                       size_t n_data, int8_t* scratch, size_t n_scratch) {
-    if (n_data < 3) {
+                       size_t n_data, int8_t* scratch, size_t n_scratch,
+                       quant::Params const& params, quat::base_type max_err, uint8_t revision,
+                       quant::Reconstruction const& recon) {
+    // room for the length, patched in once the block is compressed
+    size_t n_prefix = revision >= kGyroRevisionSized ? 1 + kGyroLengthBytes : 1;
+    if (n_data < n_prefix + 2) {
         return 0;
     }
     data[0] = 3;  // block id
-    compress::CompressResult res = compress::compress_block(state, quats, n_quats, 14, data + 1,
-                                                            n_data - 1, scratch, n_scratch);
+    uint8_t* payload = data + n_prefix;
+    size_t n_payload = n_data - n_prefix;
+    quant::Params chosen = params;
+    if (max_err > quat::base_type{}) {
+        chosen = compress::choose_params(state, quats, n_quats, params, max_err, scratch,
+                                         n_scratch);
+    }
+    compress::CompressResult res = compress::compress_block(
+        state, quats, n_quats, chosen, payload, n_payload, scratch, n_scratch, recon);
     if (!res.success) {
-        res = compress::compress_block(state, quats, n_quats, 20, data + 1, n_data - 1, scratch,
-                                       n_scratch);
+        quant::Params coarse = params;
+        std::fill(coarse.qp, coarse.qp + 3, uint8_t{20});
+        res = compress::compress_block(state, quats, n_quats, coarse, payload, n_payload, scratch,
+                                       n_scratch, recon);
+    }
+    if (!res.success || res.bytes_put >= (1U << (7 * kGyroLengthBytes))) {
+        return 0;
     }
-    if (res.success) {
-        state = res.new_state;
+    state = res.new_state;
+
+    if (revision >= kGyroRevisionSized) {
+        // padded LEB128, every byte but the last has the continuation bit set
+        for (size_t i = 0; i < kGyroLengthBytes; ++i) {
+            uint8_t more = i + 1 < kGyroLengthBytes ? 0x80 : 0;
+            data[1 + i] = ((res.bytes_put >> (7 * i)) & 0x7f) | more;
+        }
     }
 
-    return res.bytes_put + 1;
+    return res.bytes_put + n_prefix;
+}
+
+size_t write_gyro_count(uint16_t n_quats, uint8_t* out, size_t n_out) {
+    if (n_out < 3) {
+        return 0;
+    }
+    out[0] = 0x0a;  // block id
+    out[1] = (n_quats >> 0) & 0xff;
+    out[2] = (n_quats >> 8) & 0xff;
+    return 3;
 }
 
 size_t write_accel_setup(uint8_t block_size, uint8_t accel_range, uint8_t* out, size_t n_out) {
@@ -79,6 +153,50 @@ size_t write_accel_data(int16_t const* acc_data, size_t n_acc_data, uint8_t* out
     return n_acc_data * 6 + 1;
 }
 
+size_t write_accel_compressed(int16_t const* acc_data, size_t n_acc_data, uint8_t shift,
+                              uint8_t* out, size_t n_out) {
+    if (n_out < 3) {
+        return 0;
+    }
+    // noisy or full-range samples can code larger than they are, the raw block takes
+    // 6 * n + 1 bytes
+    size_t n_room = std::min<size_t>({n_out, 0xffff + 3, 6 * n_acc_data});
+    size_t n = n_room > 3 ? compress::compress_accel(acc_data, n_acc_data, shift, out + 3,
+                                                     n_room - 3)
+                          : 0;
+    if (n == 0) {
+        return write_accel_data(acc_data, n_acc_data, out, n_out);
+    }
+    out[0] = 0x0b;  // block id
+    out[1] = (n >> 0) & 0xff;
+    out[2] = (n >> 8) & 0xff;
+    return n + 3;
+}
+
+size_t write_accel_packed(int16_t const* acc_data, size_t n_acc_data, uint8_t* out,
+                          size_t n_out) {
+    if (n_out < 3) {
+        return 0;
+    }
+    size_t n = bitpack::pack_accel(acc_data, n_acc_data, out + 3, n_out - 3);
+    if (n == 0) {
+        return 0;
+    }
+    out[0] = 0x0c;  // block id
+    out[1] = (n >> 0) & 0xff;
+    out[2] = (n >> 8) & 0xff;
+    return n + 3;
+}
+
+size_t write_stream_select(uint8_t stream, uint8_t* out, size_t n_out) {
+    if (n_out < 2 || stream >= kMaxStreams) {
+        return 0;
+    }
+    out[0] = 0x0f;  // block id
+    out[1] = stream;
+    return 2;
+}
+
 size_t write_global_time(int32_t ofs_us, uint8_t* out, size_t n_out) {
     if (n_out < 5) {
         return 0;
@@ -101,4 +219,51 @@ size_t write_imu_orient(char const* orient, uint8_t* out, size_t n_out) {
     out[3] = orient[2];
     return 4;
 }
+
+static void put_u32(uint32_t v, uint8_t* out) {
+    out[0] = (v >> 0) & 0xff;
+    out[1] = (v >> 8) & 0xff;
+    out[2] = (v >> 16) & 0xff;
+    out[3] = (v >> 24) & 0xff;
+}
+
+// q, v and dv as raw little-endian int32, 40 bytes
+static void put_state(quant::State const& state, uint8_t* out) {
+    quat::base_type const values[] = {state.q.w,  state.q.x,  state.q.y,  state.q.z,  state.v.x,
+                                      state.v.y,  state.v.z,  state.dv.x, state.dv.y, state.dv.z};
+    for (size_t i = 0; i < 10; ++i) {
+        put_u32((uint32_t)values[i].raw_value(), out + 4 * i);
+    }
+}
+
+size_t write_keyframe(quant::State const& state, uint8_t* out, size_t n_out) {
+    if (n_out < 41) {
+        return 0;
+    }
+    out[0] = 0x08;  // block id
+    put_state(state, out + 1);
+    return 41;
+}
+
+size_t write_index(IndexEntry const* entries, size_t n_entries, uint32_t offset, uint8_t* out,
+                   size_t n_out) {
+    size_t size = 1 + 4 + n_entries * kIndexEntrySize + 8;
+    if (n_out < size || n_entries > std::numeric_limits<uint32_t>::max()) {
+        return 0;
+    }
+    out[0] = 0x09;  // block id
+    put_u32(n_entries, out + 1);
+    uint8_t* p = out + 5;
+    for (size_t i = 0; i < n_entries; ++i, p += kIndexEntrySize) {
+        put_u32(entries[i].sample, p + 0);
+        put_u32((uint64_t)entries[i].time_us >> 0, p + 4);
+        put_u32((uint64_t)entries[i].time_us >> 32, p + 8);
+        put_u32(entries[i].offset, p + 12);
+        put_state(entries[i].state, p + 16);
+    }
+    // trailer, lets a reader find the index from the end of the file
+    put_u32(offset, p);
+    memcpy(p + 4, kIndexMagic, 4);
+    return size;
+}
 }  // namespace writer
\ No newline at end of file
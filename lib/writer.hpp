@@ -5,20 +5,94 @@
 #include <cstring>
 
 namespace writer {
+// Seek point for the index block: the gyro data block at byte `offset` starts with sample
+// number `sample` at `time_us` and decodes from `state`.
+struct IndexEntry {
+    uint32_t sample{};
+    int64_t time_us{};
+    uint32_t offset{};
+    quant::State state{};
+};
+
+static constexpr size_t kIndexEntrySize = 56;
+static constexpr char kIndexMagic[] = "EIdx";
+
 size_t write_header(uint8_t* out, size_t n_out);
 
-size_t write_gyro_setup(uint16_t samples_per_block, uint8_t* out, size_t n_out);
+// Gyro data blocks of revision 2 and up carry their payload length as a varint after the
+// block id, so readers can skip them without decoding. The writer always uses
+// kGyroLengthBytes bytes for it.
+static constexpr uint8_t kGyroRevisionSized = 2;
+static constexpr size_t kGyroLengthBytes = 3;
+
+size_t write_gyro_setup(uint16_t samples_per_block, uint8_t* out, size_t n_out,
+                        uint8_t revision = 1);
 
 size_t write_time_block(uint32_t time_elapsed_us, uint8_t* out, size_t n_out);
 
+// Nominal gyro sample period. With it, every gyro data block is taken to last its sample count
+// times the period unless a time delta block in front of it says otherwise.
+size_t write_time_setup(uint32_t sample_period_ns, uint8_t* out, size_t n_out);
+
+// Deviation of the next gyro data block's duration from the nominal one, as a zigzag LEB128 of
+// 2 to 5 bytes in total. A zero delta need not be written at all. |delta_us| < kMaxTimeDelta.
+static constexpr int32_t kMaxTimeDelta = 1 << 27;
+
+size_t write_time_delta(int32_t delta_us, uint8_t* out, size_t n_out);
+
+// Quantization of gyro data blocks unless the caller picks another one: the legacy floor
+// rounding and constant velocity prediction, which every decoder understands.
+static constexpr quant::Params kGyroParams{.qp = {14, 14, 14}};
+
+// If max_err is set, the per-axis quantization is coarsened from `params` as far as that error
+// allows. `revision` must match the one in the gyro setup block. `recon` receives what a
+// decoder will reconstruct from the block.
 size_t write_gyro_data(quant::State& state, quat::quat const* quats, size_t n_quats, uint8_t* data,
-                       size_t n_data, int8_t* scratch, size_t n_scratch);
+                       size_t n_data, int8_t* scratch, size_t n_scratch,
+                       quant::Params const& params = kGyroParams, quat::base_type max_err = {},
+                       uint8_t revision = 1, quant::Reconstruction const& recon = {});
+
+// Buffer sizes for write_gyro_data: scratch for the symbols of a block of n_quats, at most
+// compress::kMaxSymbolsPerSample per sample, and room for the largest block that can come of
+// them. With max_rate (see quant::max_symbols) they shrink. Blocks that need more scratch are
+// retried with coarser quantization.
+size_t gyro_scratch_size(size_t n_quats, double max_rate = quant::kAnyRate,
+                         quant::Params const& params = kGyroParams);
+size_t max_gyro_data_size(size_t n_quats, double max_rate = quant::kAnyRate,
+                          quant::Params const& params = kGyroParams);
+
+// Sample count of the next gyro data block, for a short final block.
+size_t write_gyro_count(uint16_t n_quats, uint8_t* out, size_t n_out);
 
 size_t write_accel_setup(uint8_t block_size, uint8_t accel_range, uint8_t* out, size_t n_out);
 
 size_t write_accel_data(int16_t const* acc_data, size_t n_acc_data, uint8_t* out, size_t n_out);
 
+// Entropy coded alternative to write_accel_data, see compress::compress_accel. Each residual
+// is rounded to a multiple of 2^shift, 0 keeps the samples exact. Falls back to a raw accel
+// block if coding would not make the block smaller.
+size_t write_accel_compressed(int16_t const* acc_data, size_t n_acc_data, uint8_t shift,
+                              uint8_t* out, size_t n_out);
+
+// Lossless accel block without entropy coding, see bitpack::pack_accel.
+size_t write_accel_packed(int16_t const* acc_data, size_t n_acc_data, uint8_t* out,
+                          size_t n_out);
+
 size_t write_global_time(int32_t ofs_us, uint8_t* out, size_t n_out);
 
 size_t write_imu_orient(char const* orient, uint8_t* out, size_t n_out);
+
+// Multiplexed files: the blocks after a stream select block belong to the selected stream,
+// each stream has its own setup, quantizer state and time. Without one it is stream 0.
+static constexpr uint8_t kMaxStreams = 16;
+
+size_t write_stream_select(uint8_t stream, uint8_t* out, size_t n_out);
+
+// Absolute quantizer state, gyro data blocks after it do not depend on anything before.
+size_t write_keyframe(quant::State const& state, uint8_t* out, size_t n_out);
+
+// Written last. `offset` is the file offset this block is written at, entries are sorted by
+// time. The block ends with that offset and a magic so readers can locate it from the end.
+size_t write_index(IndexEntry const* entries, size_t n_entries, uint32_t offset, uint8_t* out,
+                   size_t n_out);
 }  // namespace writer
\ No newline at end of file